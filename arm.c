@@ -116,6 +116,11 @@ void i_label(long id)
 	lab_add(id + 1);
 }
 
+long i_labpos(long id)
+{
+	return lab_loc[id + 1];
+}
+
 static void rel_add(long sym, long flg, long off)
 {
 	if (rel_n == rel_sz) {
@@ -294,6 +299,18 @@ static void i_mul(int rd, int rn, int rm)
 	oi4(MUL(rd, rn, rm));
 }
 
+/* smull or umull; the high word of the product in rd */
+static void i_mulh(long op, int rd, int rn, int rm)
+{
+	int s = O_T(op) & T_MSIGN ? 1 : 0;
+	if (rd == rm) {		/* rdhi and rm should differ */
+		rm = rn;
+		rn = rd;
+	}
+	oi4((14 << 28) | (1 << 23) | (s << 22) | (rd << 16) |
+		(REG_TMP << 12) | (rn << 8) | (9 << 4) | rm);
+}
+
 static int opcode_set(long op)
 {
 	/* lt, ge, eq, ne, le, gt */
@@ -592,6 +609,10 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		*r2 = oc & O_NUM ? 0 : R_TMPS;
 		return 0;
 	}
+	if (oc == O_JTAB) {
+		*r1 = R_TMPS;
+		return 0;
+	}
 	if (oc == O_JMP)
 		return 0;
 	return 1;
@@ -624,6 +645,8 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_div(O_T(op) & T_MSIGN ? "__divdi3" : "__udivdi3");
 		if (oc == O_MOD)
 			i_div(O_T(op) & T_MSIGN ? "__moddi3" : "__umoddi3");
+		if (oc == O_MULH)
+			i_mulh(op, rd, r1, r2);
 		return 0;
 	}
 	if (oc & O_CMP) {
@@ -669,6 +692,12 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		i_memcpy(r1, r2, r3);
 		return 0;
 	}
+	if (oc == O_JTAB) {
+		i_sym(REG_TMP, r2, 0);
+		/* ldr pc, [ip, r1, lsl #2] */
+		oi4(0xe790f100 | (REG_TMP << 16) | r1);
+		return 0;
+	}
 	if (oc == O_RET) {
 		jmp_ret = opos();
 		jmp_add(i_jmp(O_JMP, 0, 0), 0);
@@ -818,6 +847,10 @@ void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *
 	func_call = 0;
 }
 
+void i_init(long flags)
+{
+}
+
 void i_done(void)
 {
 	if (putdiv) {
@@ -831,4 +864,26 @@ void i_done(void)
 	free(lab_loc);
 	free(num_sym);
 	free(num_off);
+	free(rel_sym);
+	free(rel_flg);
+	free(rel_off);
+	mem_done(&cs);
+	jmp_off = NULL;
+	jmp_dst = NULL;
+	lab_loc = NULL;
+	rel_sym = NULL;
+	rel_flg = NULL;
+	rel_off = NULL;
+	rel_n = 0;
+	rel_sz = 0;
+	lab_sz = 0;
+	jmp_n = 0;
+	jmp_sz = 0;
+	jmp_ret = 0;
+	num_sym = NULL;
+	num_off = NULL;
+	num_n = 0;
+	num_sz = 0;
+	putdiv = 0;
+	func_call = 0;
 }
@@ -8,6 +8,7 @@
 #define R_TMPS		0x03ff	/* mask of tmp registers */
 #define R_ARGS		0x000f	/* mask of arg registers */
 #define R_PERM		0x0ff0	/* mask of callee-saved registers */
+#define I_SERIAL	1	/* i_ins() defines symbols; no code generation workers */
 
 /* special registers */
 #define REG_FP		11	/* frame pointer register */
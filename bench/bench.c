@@ -0,0 +1,227 @@
+/* run the compile-time benchmark */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*
+ * Compile each input at every optimization level and print a
+ * tab-separated line for each: the input, the level, the number of
+ * lines (including the headers it includes), the time of the fastest
+ * of the runs in seconds, lines per second, peak RSS in kilobytes and
+ * the phase times of -ftime-report in milliseconds.  With -c, compare
+ * two such outputs.
+ */
+
+#define NPHASES		32		/* maximum number of reported phases */
+#define NLINE		1024		/* maximum line length */
+#define NLEVELS		3		/* optimization levels (-O0 to -O2) */
+
+static char *inputs[] = {"hdr.c", "switch.c", "long.c", "table.c", "macro.c"};
+
+static char phase_name[NPHASES][64];
+static double phase_ms[NPHASES];
+static int phase_n;
+
+static char seen[256][64];	/* files counted by lines() */
+static int seen_n;
+
+/* the number of lines in name and the files it includes, once each */
+static long lines(char *dir, char *name, int depth)
+{
+	char path[NLINE], line[NLINE];
+	FILE *fp;
+	long n = 0;
+	int i;
+	if (!depth)
+		seen_n = 0;
+	for (i = 0; i < seen_n; i++)
+		if (!strcmp(seen[i], name))
+			return 0;
+	if (seen_n < 256)
+		snprintf(seen[seen_n++], sizeof(seen[0]), "%s", name);
+	sprintf(path, "%s/%s", dir, name);
+	if (depth > 64 || !(fp = fopen(path, "r")))
+		return 0;
+	while (fgets(line, sizeof(line), fp)) {
+		char *s = line, *e;
+		n++;
+		if (strncmp(s, "#include \"", 10) || !(e = strchr(s + 10, '"')))
+			continue;
+		*e = '\0';
+		n += lines(dir, s + 10, depth + 1);
+	}
+	fclose(fp);
+	return n;
+}
+
+/* parse the output of -ftime-report */
+static void phases(char *s)
+{
+	char *e;
+	phase_n = 0;
+	for (s = strchr(s, '\n'); s && (e = strchr(++s, '\n')); s = e) {
+		char *v = e;
+		*e = '\0';
+		if (strstr(s, "slowest"))
+			break;
+		while (v > s && v[-1] != ' ')
+			v--;
+		if (v == s || strncmp(s, "  ", 2) || !strchr("0123456789", *v))
+			continue;
+		if (phase_n < NPHASES) {
+			char *d = phase_name[phase_n];
+			for (s += 2; s < v && (*s != ' ' || s[1] != ' '); s++)
+				if (d - phase_name[phase_n] < sizeof(phase_name[0]) - 1)
+					*d++ = *s == ' ' ? '_' : *s;
+			*d = '\0';
+			phase_ms[phase_n++] = atof(v);
+		}
+	}
+}
+
+/* compile path at the given level; return the time or -1 on failure */
+static double run(char *ncc, char *dir, char *path, int level, long *rss)
+{
+	char inc[NLINE], opt[16], out[NLINE];
+	static char buf[1 << 16];
+	struct timespec t0, t1;
+	struct rusage ru;
+	long n, len = 0;
+	int fds[2];
+	int pid, status;
+	sprintf(inc, "-I%s", dir);
+	sprintf(opt, "-O%d", level);
+	sprintf(out, "%s/bench.o", dir);
+	if (pipe(fds))
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (!(pid = fork())) {
+		close(fds[0]);
+		dup2(fds[1], 2);
+		execl(ncc, ncc, opt, "-ftime-report", inc, "-o", out, path, NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+	while (len < sizeof(buf) - 1 &&
+			(n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0)
+		len += n;
+	buf[len] = '\0';
+	close(fds[0]);
+	if (pid < 0 || wait4(pid, &status, 0, &ru) < 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	unlink(out);
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fputs(buf, stderr);
+		return -1;
+	}
+	phases(buf);
+	*rss = ru.ru_maxrss;
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static int bench(char *ncc, char *dir, int runs)
+{
+	char path[NLINE];
+	double best_ms[NPHASES];
+	int i, j, k, l;
+	int hdr = 0;
+	for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+		long n = lines(dir, inputs[i], 0);
+		sprintf(path, "%s/%s", dir, inputs[i]);
+		for (l = 0; l < NLEVELS; l++) {
+			double best = -1;
+			long rss = 0, best_rss = 0;
+			for (k = 0; k < runs; k++) {
+				double t = run(ncc, dir, path, l, &rss);
+				if (t < 0) {
+					fprintf(stderr, "bench: %s -O%d failed\n",
+						inputs[i], l);
+					return 1;
+				}
+				if (rss > best_rss)
+					best_rss = rss;
+				if (best < 0 || t < best) {
+					best = t;
+					memcpy(best_ms, phase_ms, sizeof(best_ms));
+				}
+			}
+			if (!hdr++) {
+				printf("file\topt\tlines\tsecs\tlines/s\tmaxrss_kb");
+				for (j = 0; j < phase_n; j++)
+					printf("\t%s_ms", phase_name[j]);
+				printf("\n");
+			}
+			printf("%s\t-O%d\t%ld\t%.4f\t%.0f\t%ld", inputs[i], l,
+				n, best, n / best, best_rss);
+			for (j = 0; j < phase_n; j++)
+				printf("\t%.3f", best_ms[j]);
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
+
+/* read the lines/s and maxrss columns of a benchmark output */
+static int cmp_read(char *path, char (*key)[64], double *lps, long *rss, int max)
+{
+	char line[NLINE * 4];
+	FILE *fp = fopen(path, "r");
+	int n = 0;
+	if (!fp) {
+		fprintf(stderr, "bench: cannot open <%s>\n", path);
+		exit(1);
+	}
+	fgets(line, sizeof(line), fp);
+	while (n < max && fgets(line, sizeof(line), fp)) {
+		char file[64], opt[16];
+		long lns;
+		double secs;
+		if (sscanf(line, "%63s %15s %ld %lf %lf %ld", file, opt,
+				&lns, &secs, &lps[n], &rss[n]) != 6)
+			continue;
+		sprintf(key[n++], "%.40s %.8s", file, opt);
+	}
+	fclose(fp);
+	return n;
+}
+
+/* compare two benchmark outputs */
+static int cmp(char *old, char *new)
+{
+	static char k1[256][64], k2[256][64];
+	static double lps1[256], lps2[256];
+	static long rss1[256], rss2[256];
+	int n1 = cmp_read(old, k1, lps1, rss1, 256);
+	int n2 = cmp_read(new, k2, lps2, rss2, 256);
+	int i, j;
+	printf("%-20s %12s %12s %8s %8s\n", "input", "old lines/s",
+		"new lines/s", "speed", "rss");
+	for (i = 0; i < n2; i++) {
+		for (j = 0; j < n1 && strcmp(k1[j], k2[i]); j++)
+			;
+		if (j < n1)
+			printf("%-20s %12.0f %12.0f %7.2fx %7.2fx\n", k2[i],
+				lps1[j], lps2[i], lps2[i] / lps1[j],
+				(double) rss2[i] / rss1[j]);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 4 && !strcmp(argv[1], "-c"))
+		return cmp(argv[2], argv[3]);
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s ncc dir [runs]\n", argv[0]);
+		fprintf(stderr, "       %s -c old.tsv new.tsv\n", argv[0]);
+		return 1;
+	}
+	return bench(argv[1], argv[2], argc > 3 ? atoi(argv[3]) : 3);
+}
@@ -0,0 +1,203 @@
+/* generate the compile-time benchmark inputs */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The inputs depend only on the scale argument: header-heavy code
+ * (hdr.c), a huge switch statement (switch.c), long functions
+ * (long.c), big static initializers (table.c) and deeply nested macros
+ * (macro.c).  They include only the headers generated here.
+ */
+
+#define NHDRS		48		/* number of headers included by hdr.c */
+#define MDEPTH		14		/* macro nesting depth in macro.c */
+
+static unsigned long seed = 1;
+static char *dir;
+
+static long rnd(long n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+static FILE *gen_open(char *name)
+{
+	char path[1024];
+	FILE *fp;
+	sprintf(path, "%s/%s", dir, name);
+	if (!(fp = fopen(path, "w"))) {
+		fprintf(stderr, "gen: cannot create <%s>\n", path);
+		exit(1);
+	}
+	return fp;
+}
+
+static void gen_hdr(int scale)
+{
+	FILE *fp;
+	char name[64];
+	int i, j;
+	for (i = 0; i < NHDRS; i++) {
+		sprintf(name, "h%02d.h", i);
+		fp = gen_open(name);
+		fprintf(fp, "#ifndef H%02d_H\n#define H%02d_H\n", i, i);
+		if (i)
+			fprintf(fp, "#include \"h%02d.h\"\n", i - 1);
+		for (j = 0; j < 12; j++)
+			fprintf(fp, "#define H%d_M%d(a, b)\t((a) * %ld + (b) - %d)\n",
+				i, j, rnd(100), j);
+		fprintf(fp, "enum h%d_e {", i);
+		for (j = 0; j < 16; j++)
+			fprintf(fp, "%sH%d_E%d", j ? ", " : "", i, j);
+		fprintf(fp, "};\n");
+		for (j = 0; j < 8 * scale; j++) {
+			fprintf(fp, "struct h%d_s%d {\n\tint a;\n\tlong b[%ld];\n"
+				"\tchar *name;\n\tstruct h%d_s%d *next;\n};\n",
+				i, j, rnd(8) + 1, i, j);
+			fprintf(fp, "typedef struct h%d_s%d h%d_t%d;\n", i, j, i, j);
+			fprintf(fp, "int h%d_f%d(h%d_t%d *p, int n, char *s);\n",
+				i, j, i, j);
+			fprintf(fp, "extern long h%d_v%d[%ld];\n", i, j, rnd(64) + 1);
+		}
+		fprintf(fp, "#endif\n");
+		fclose(fp);
+	}
+	fp = gen_open("hdr.c");
+	for (i = 0; i < NHDRS; i++)
+		fprintf(fp, "#include \"h%02d.h\"\n", i);
+	for (i = 0; i < NHDRS; i++) {
+		fprintf(fp, "int use%d(h%d_t0 *p, int n)\n{\n", i, i);
+		fprintf(fp, "\tint s = H%d_E%ld;\n", i, rnd(16));
+		fprintf(fp, "\twhile (p && n--) {\n");
+		fprintf(fp, "\t\ts += H%d_M%ld(p->a, n) + h%d_f0(p, n, p->name);\n",
+			i, rnd(12), i);
+		fprintf(fp, "\t\tp = p->next;\n\t}\n\treturn s;\n}\n");
+	}
+	fclose(fp);
+}
+
+static void gen_switch(int scale)
+{
+	FILE *fp = gen_open("switch.c");
+	int i, j;
+	for (j = 0; j < 4; j++) {
+		fprintf(fp, "int sw%d(int x, int y)\n{\n\tswitch (x) {\n", j);
+		for (i = 0; i < 500 * scale; i++) {
+			/* dense cases in the first and sparse ones in the other */
+			long c = j % 2 ? i * 7 + rnd(7) : i;
+			fprintf(fp, "\tcase %ld:\n", c);
+			if (rnd(4))
+				fprintf(fp, "\t\treturn y * %ld + %ld;\n",
+					rnd(50), rnd(1000));
+			else
+				fprintf(fp, "\t\ty += x >> %ld;\n\t\tbreak;\n",
+					rnd(8));
+		}
+		fprintf(fp, "\tdefault:\n\t\treturn -1;\n\t}\n\treturn y;\n}\n");
+	}
+	fclose(fp);
+}
+
+static void gen_long(int scale)
+{
+	FILE *fp = gen_open("long.c");
+	int i, j, k;
+	for (j = 0; j < 4; j++)
+		fprintf(fp, "long fn%d(long *a, long n);\n", j);
+	for (j = 0; j < 4; j++) {
+		fprintf(fp, "long fn%d(long *a, long n)\n{\n", j);
+		for (k = 0; k < 16; k++)
+			fprintf(fp, "\tlong v%d = n + %d;\n", k, k);
+		fprintf(fp, "\tlong i;\n");
+		for (i = 0; i < 600 * scale; i++) {
+			int d = rnd(16), s1 = rnd(16), s2 = rnd(16);
+			switch (rnd(5)) {
+			case 0:
+				fprintf(fp, "\tv%d = v%d * %ld + v%d;\n",
+					d, s1, rnd(100), s2);
+				break;
+			case 1:
+				fprintf(fp, "\tif (v%d > v%d)\n\t\tv%d = a[v%d & 15];\n",
+					s1, s2, d, s1);
+				break;
+			case 2:
+				fprintf(fp, "\tfor (i = 0; i < %ld; i++)\n"
+					"\t\tv%d += a[i] ^ v%d;\n", rnd(16), d, s1);
+				break;
+			case 3:
+				fprintf(fp, "\ta[%ld] = v%d - (v%d << %ld);\n",
+					rnd(16), s1, s2, rnd(8));
+				break;
+			default:
+				fprintf(fp, "\tv%d = fn%d(a, v%d & 3);\n",
+					d, (j + 1) % 4, s1);
+				break;
+			}
+		}
+		fprintf(fp, "\treturn v0");
+		for (k = 1; k < 16; k++)
+			fprintf(fp, " + v%d", k);
+		fprintf(fp, ";\n}\n");
+	}
+	fclose(fp);
+}
+
+static void gen_table(int scale)
+{
+	FILE *fp = gen_open("table.c");
+	int i, j;
+	fprintf(fp, "struct ent {\n\tchar *name;\n\tint id;\n\tlong val[4];\n};\n");
+	for (j = 0; j < 4; j++) {
+		fprintf(fp, "static long tab%d[] = {", j);
+		for (i = 0; i < 4000 * scale; i++)
+			fprintf(fp, "%s%ld,", i % 8 ? " " : "\n\t", rnd(1 << 20));
+		fprintf(fp, "\n};\n");
+		fprintf(fp, "static struct ent ents%d[] = {\n", j);
+		for (i = 0; i < 500 * scale; i++)
+			fprintf(fp, "\t{\"ent%d_%d\", %d, {%ld, %ld, %ld, %ld}},\n",
+				j, i, i, rnd(100), rnd(100), rnd(100), rnd(100));
+		fprintf(fp, "};\n");
+		fprintf(fp, "long sum%d(void)\n{\n\tlong s = 0;\n\tint i;\n"
+			"\tfor (i = 0; i < sizeof(tab%d) / sizeof(tab%d[0]); i++)\n"
+			"\t\ts += tab%d[i] + ents%d[i %% %d].val[i & 3];\n"
+			"\treturn s;\n}\n", j, j, j, j, j, 500 * scale);
+	}
+	fclose(fp);
+}
+
+static void gen_macro(int scale)
+{
+	FILE *fp = gen_open("macro.c");
+	int i, j;
+	fprintf(fp, "#define N0(x)\t((x) + 1)\n");
+	for (i = 1; i < MDEPTH; i++)
+		fprintf(fp, "#define N%d(x)\tN%d((x) * 3 + %d)\n", i, i - 1, i);
+	fprintf(fp, "#define MAX(a, b)\t((a) < (b) ? (b) : (a))\n");
+	fprintf(fp, "#define STR(a)\t#a\n");
+	for (j = 0; j < 8 * scale; j++) {
+		fprintf(fp, "long mac%d(long x)\n{\n\tlong s = 0;\n", j);
+		for (i = 0; i < 40; i++)
+			fprintf(fp, "\ts += MAX(N%ld(x + %d), N%ld(s)) + sizeof(STR(N%ld));\n",
+				rnd(MDEPTH), i, rnd(MDEPTH), rnd(MDEPTH));
+		fprintf(fp, "\treturn s;\n}\n");
+	}
+	fclose(fp);
+}
+
+int main(int argc, char *argv[])
+{
+	int scale = argc > 2 ? atoi(argv[2]) : 1;
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s dir [scale]\n", argv[0]);
+		return 1;
+	}
+	dir = argv[1];
+	gen_hdr(scale);
+	gen_switch(scale);
+	gen_long(scale);
+	gen_table(scale);
+	gen_macro(scale);
+	return 0;
+}
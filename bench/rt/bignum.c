@@ -0,0 +1,77 @@
+/* bignum arithmetic with 16-bit limbs: factorials and powers */
+int printf(char *fmt, ...);
+
+#define NLIMBS		4096
+
+static unsigned x[NLIMBS], y[NLIMBS], z[NLIMBS * 2];
+
+/* a = a * m; return the number of limbs */
+static int mul1(unsigned *a, int n, unsigned m)
+{
+	unsigned c = 0;
+	int i;
+	for (i = 0; i < n; i++) {
+		unsigned v = a[i] * m + c;
+		a[i] = v & 0xffff;
+		c = v >> 16;
+	}
+	while (c) {
+		a[n++] = c & 0xffff;
+		c >>= 16;
+	}
+	return n;
+}
+
+/* z = a * b */
+static int mul(unsigned *a, int na, unsigned *b, int nb, unsigned *z)
+{
+	int i, j;
+	for (i = 0; i < na + nb; i++)
+		z[i] = 0;
+	for (i = 0; i < na; i++) {
+		unsigned c = 0;
+		for (j = 0; j < nb; j++) {
+			unsigned v = a[i] * b[j] + z[i + j] + c;
+			z[i + j] = v & 0xffff;
+			c = v >> 16;
+		}
+		z[i + nb] = c;
+	}
+	while (na + nb > 1 && !z[na + nb - 1])
+		nb--;
+	return na + nb;
+}
+
+/* a = a / d; return the remainder */
+static unsigned div1(unsigned *a, int n, unsigned d)
+{
+	unsigned r = 0;
+	int i;
+	for (i = n - 1; i >= 0; i--) {
+		unsigned v = (r << 16) | a[i];
+		a[i] = v / d;
+		r = v % d;
+	}
+	return r;
+}
+
+int main(void)
+{
+	unsigned sum = 0;
+	int n = 1, ny, nz, i, r;
+	x[0] = 1;
+	for (i = 2; i <= 3000; i++)	/* 3000! */
+		n = mul1(x, n, i);
+	for (i = 0; i < n; i++)
+		y[i] = x[i];
+	ny = n;
+	for (r = 0; r < 100; r++) {
+		nz = mul(x, n / 2, y, ny / 2, z);
+		for (i = 0; i < nz; i++)
+			sum = sum * 31 + z[i];
+	}
+	for (i = 0; i < 200; i++)
+		sum += div1(x, n, 9973 + i);
+	printf("%u %d\n", sum, n);
+	return 0;
+}
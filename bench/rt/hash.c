@@ -0,0 +1,68 @@
+/* hashing: FNV-1a over a buffer and an open-addressing hash table */
+int printf(char *fmt, ...);
+
+#define BUFSZ		(1 << 16)
+#define TABSZ		(1 << 16)
+#define ROUNDS		200
+
+static unsigned char buf[BUFSZ];
+static unsigned keys[TABSZ];
+static unsigned vals[TABSZ];
+
+static unsigned fnv(unsigned char *s, int n)
+{
+	unsigned h = 2166136261u;
+	int i;
+	for (i = 0; i < n; i++)
+		h = (h ^ s[i]) * 16777619u;
+	return h;
+}
+
+static unsigned mix(unsigned x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+static void put(unsigned key, unsigned val)
+{
+	unsigned i = mix(key) & (TABSZ - 1);
+	while (keys[i] && keys[i] != key)
+		i = (i + 1) & (TABSZ - 1);
+	keys[i] = key;
+	vals[i] += val;
+}
+
+static unsigned get(unsigned key)
+{
+	unsigned i = mix(key) & (TABSZ - 1);
+	while (keys[i] && keys[i] != key)
+		i = (i + 1) & (TABSZ - 1);
+	return keys[i] ? vals[i] : 0;
+}
+
+int main(void)
+{
+	unsigned seed = 1, sum = 0;
+	int i, r;
+	for (i = 0; i < BUFSZ; i++) {
+		seed = seed * 1103515245u + 12345u;
+		buf[i] = seed >> 16;
+	}
+	for (r = 0; r < ROUNDS; r++) {
+		sum += fnv(buf + r, BUFSZ - r);
+		for (i = 0; i < TABSZ / 2; i++)
+			put(mix(i + r * 7) | 1, i);
+		for (i = 0; i < TABSZ / 2; i += 3)
+			sum += get(mix(i + r * 7) | 1);
+		if (r % 16 == 15)
+			for (i = 0; i < TABSZ; i++)
+				keys[i] = 0;
+	}
+	printf("%u\n", sum);
+	return 0;
+}
@@ -0,0 +1,88 @@
+/* an interpreter loop: a stack machine running a few programs */
+int printf(char *fmt, ...);
+
+enum {PUSH, LOAD, STORE, ADD, SUB, MUL, LT, JZ, JMP, DUP, DROP, MOD, HALT};
+
+static long stack[256];
+static long vars[16];
+
+static long run(int *code)
+{
+	long *sp = stack;
+	int pc = 0;
+	while (1) {
+		switch (code[pc++]) {
+		case PUSH:
+			*sp++ = code[pc++];
+			break;
+		case LOAD:
+			*sp++ = vars[code[pc++]];
+			break;
+		case STORE:
+			vars[code[pc++]] = *--sp;
+			break;
+		case ADD:
+			sp--;
+			sp[-1] += sp[0];
+			break;
+		case SUB:
+			sp--;
+			sp[-1] -= sp[0];
+			break;
+		case MUL:
+			sp--;
+			sp[-1] *= sp[0];
+			break;
+		case MOD:
+			sp--;
+			sp[-1] %= sp[0];
+			break;
+		case LT:
+			sp--;
+			sp[-1] = sp[-1] < sp[0];
+			break;
+		case JZ:
+			if (!*--sp)
+				pc = code[pc];
+			else
+				pc++;
+			break;
+		case JMP:
+			pc = code[pc];
+			break;
+		case DUP:
+			sp[0] = sp[-1];
+			sp++;
+			break;
+		case DROP:
+			sp--;
+			break;
+		case HALT:
+			return sp > stack ? sp[-1] : 0;
+		}
+	}
+}
+
+/* s = 0; for (i = 0; i < n; i++) s = (s * 31 + i) % 1000003; */
+static int prog[] = {
+	PUSH, 0, STORE, 0,		/* 0: s = 0 */
+	PUSH, 0, STORE, 1,		/* 4: i = 0 */
+	LOAD, 1, LOAD, 2, LT, JZ, 36,	/* 8: while (i < n) */
+	LOAD, 0, PUSH, 31, MUL, LOAD, 1, ADD, PUSH, 1000003, MOD, STORE, 0,
+	LOAD, 1, PUSH, 1, ADD, STORE, 1,
+	JMP, 8,
+	LOAD, 0, HALT,			/* 37 */
+};
+
+int main(void)
+{
+	long sum = 0;
+	int r;
+	prog[14] = 37;
+	for (r = 0; r < 20; r++) {
+		vars[2] = 500000 + r;
+		sum += run(prog);
+	}
+	printf("%ld\n", sum);
+	return 0;
+}
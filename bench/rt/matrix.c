@@ -0,0 +1,60 @@
+/* matrix code: integer multiplication, transposition and convolution */
+int printf(char *fmt, ...);
+
+#define N		160
+
+static int a[N][N], b[N][N], c[N][N], t[N][N];
+
+static void mul(int (*a)[N], int (*b)[N], int (*c)[N])
+{
+	int i, j, k;
+	for (i = 0; i < N; i++)
+		for (j = 0; j < N; j++) {
+			int s = 0;
+			for (k = 0; k < N; k++)
+				s += a[i][k] * b[k][j];
+			c[i][j] = s;
+		}
+}
+
+static void transpose(int (*a)[N], int (*t)[N])
+{
+	int i, j;
+	for (i = 0; i < N; i++)
+		for (j = 0; j < N; j++)
+			t[j][i] = a[i][j];
+}
+
+static unsigned conv(int (*a)[N])
+{
+	unsigned s = 0;
+	int i, j;
+	for (i = 1; i < N - 1; i++)
+		for (j = 1; j < N - 1; j++)
+			s += a[i - 1][j] + a[i + 1][j] + a[i][j - 1] +
+				a[i][j + 1] - 4 * a[i][j];
+	return s;
+}
+
+int main(void)
+{
+	unsigned seed = 5, sum = 0;
+	int i, j, r;
+	for (i = 0; i < N; i++)
+		for (j = 0; j < N; j++) {
+			seed = seed * 1103515245u + 12345u;
+			a[i][j] = (seed >> 16) % 100 - 50;
+			b[j][i] = (seed >> 8) % 100 - 50;
+		}
+	for (r = 0; r < 6; r++) {
+		mul(a, b, c);
+		transpose(c, t);
+		mul(t, a, b);
+		for (i = 0; i < N; i++)
+			for (j = 0; j < N; j++)
+				b[i][j] %= 1000;
+		sum += conv(c) + conv(b);
+	}
+	printf("%u\n", sum);
+	return 0;
+}
@@ -0,0 +1,85 @@
+/* sorting: quicksort, merge sort and insertion sort of integers */
+int printf(char *fmt, ...);
+
+#define N		(1 << 17)
+#define ROUNDS		12
+
+static int a[N], b[N], t[N];
+
+static void isort(int *a, int n)
+{
+	int i, j, x;
+	for (i = 1; i < n; i++) {
+		x = a[i];
+		for (j = i; j > 0 && a[j - 1] > x; j--)
+			a[j] = a[j - 1];
+		a[j] = x;
+	}
+}
+
+static void qsort_(int *a, int n)
+{
+	int i, j, p, x;
+	while (n > 16) {
+		p = a[n / 2];
+		i = 0;
+		j = n - 1;
+		while (i <= j) {
+			while (a[i] < p)
+				i++;
+			while (a[j] > p)
+				j--;
+			if (i <= j) {
+				x = a[i];
+				a[i++] = a[j];
+				a[j--] = x;
+			}
+		}
+		if (j + 1 < n - i) {
+			qsort_(a, j + 1);
+			a += i;
+			n -= i;
+		} else {
+			qsort_(a + i, n - i);
+			n = j + 1;
+		}
+	}
+	isort(a, n);
+}
+
+static void msort(int *a, int n)
+{
+	int m = n / 2, i = 0, j = m, k = 0;
+	if (n < 2)
+		return;
+	msort(a, m);
+	msort(a + m, n - m);
+	while (i < m && j < n)
+		t[k++] = a[i] <= a[j] ? a[i++] : a[j++];
+	while (i < m)
+		t[k++] = a[i++];
+	while (j < n)
+		t[k++] = a[j++];
+	for (i = 0; i < n; i++)
+		a[i] = t[i];
+}
+
+int main(void)
+{
+	unsigned seed = 7, sum = 0;
+	int i, r;
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < N; i++) {
+			seed = seed * 1664525u + 1013904223u;
+			a[i] = b[i] = (seed >> 8) % 1000000;
+		}
+		qsort_(a, N);
+		msort(b, N);
+		for (i = 0; i < N; i++)
+			if (a[i] != b[i] || (i && a[i - 1] > a[i]))
+				return 1;
+		sum += a[r * 1000] + a[N - 1 - r];
+	}
+	printf("%u\n", sum);
+	return 0;
+}
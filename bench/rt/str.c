@@ -0,0 +1,76 @@
+/* string scanning: length, word counting and substring search */
+int printf(char *fmt, ...);
+
+#define N		(1 << 18)
+#define ROUNDS		30
+
+static char text[N + 1];
+static char *words[] = {"the", "quick", "brown", "fox", "jumps", "over",
+	"lazy", "dog", "neatcc", "compiles", "small", "programs"};
+
+static int len(char *s)
+{
+	char *r = s;
+	while (*r)
+		r++;
+	return r - s;
+}
+
+static int wordcount(char *s)
+{
+	int n = 0, in = 0;
+	for (; *s; s++) {
+		int sp = *s == ' ' || *s == '\n';
+		if (!sp && !in)
+			n++;
+		in = !sp;
+	}
+	return n;
+}
+
+static int search(char *s, char *pat)
+{
+	int n = 0, m = len(pat);
+	int i;
+	for (; *s; s++) {
+		if (*s != pat[0])
+			continue;
+		for (i = 1; i < m && s[i] == pat[i]; i++)
+			;
+		if (i == m)
+			n++;
+	}
+	return n;
+}
+
+static int upper(char *s)
+{
+	int n = 0;
+	for (; *s; s++)
+		if (*s >= 'a' && *s <= 'z')
+			n += *s - 'a' + 'A';
+	return n;
+}
+
+int main(void)
+{
+	unsigned seed = 3, sum = 0;
+	int i = 0, r;
+	while (i < N - 16) {
+		char *w;
+		seed = seed * 1103515245u + 12345u;
+		w = words[(seed >> 16) % 12];
+		while (*w)
+			text[i++] = *w++;
+		text[i++] = (seed >> 8) % 10 ? ' ' : '\n';
+	}
+	text[i] = '\0';
+	for (r = 0; r < ROUNDS; r++) {
+		sum += len(text + r);
+		sum += wordcount(text + r);
+		sum += search(text, words[r % 12]);
+		sum += upper(text + r * 3);
+	}
+	printf("%u\n", sum);
+	return 0;
+}
@@ -0,0 +1,233 @@
+/* run the generated-code benchmark */
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*
+ * Build each kernel with ncc and with the reference compiler, check
+ * that both print the same output and print a tab-separated line for
+ * each: the CPU time of the fastest run of each binary in seconds,
+ * their ratio, the size of the code in their objects in bytes and the
+ * number of instructions each executes (from perf stat, or -1 if it
+ * is not available).
+ *
+ * Neatcc's x86-64 objects keep relocation addends in place, as
+ * neatld expects; they are moved to r_addend before linking the
+ * objects with the reference compiler.
+ */
+
+#define NCMD		4096		/* maximum command length */
+
+static char *kernels[] = {"hash", "sort", "str", "interp", "matrix", "bignum"};
+
+static char *rt_cc;		/* the reference compiler and its flags */
+static char *rt_dir;		/* kernel directory */
+
+static char *readfile(char *path, long *len)
+{
+	FILE *fp = fopen(path, "r");
+	char *buf;
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	*len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = malloc(*len + 1);
+	*len = fread(buf, 1, *len, fp);
+	buf[*len] = '\0';
+	fclose(fp);
+	return buf;
+}
+
+static int writefile(char *path, char *buf, long len)
+{
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+		return 1;
+	fwrite(buf, 1, len, fp);
+	return fclose(fp) != 0;
+}
+
+/* move the addends of x86-64 relocations to r_addend */
+static int elf_fixrela(char *path)
+{
+	Elf64_Ehdr *ehdr;
+	Elf64_Shdr *shdr;
+	long len;
+	char *buf = readfile(path, &len);
+	int i, j;
+	if (!buf)
+		return 1;
+	ehdr = (void *) buf;
+	if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_machine != EM_X86_64) {
+		free(buf);
+		return 0;
+	}
+	shdr = (void *) (buf + ehdr->e_shoff);
+	for (i = 0; i < ehdr->e_shnum; i++) {
+		Elf64_Rela *rela = (void *) (buf + shdr[i].sh_offset);
+		char *sec = buf + shdr[shdr[i].sh_info].sh_offset;
+		if (shdr[i].sh_type != SHT_RELA)
+			continue;
+		for (j = 0; j < shdr[i].sh_size / sizeof(rela[0]); j++) {
+			char *p = sec + rela[j].r_offset;
+			if (ELF64_R_TYPE(rela[j].r_info) == R_X86_64_64) {
+				memcpy(&rela[j].r_addend, p, 8);
+				memset(p, 0, 8);
+			} else {
+				int v;
+				memcpy(&v, p, 4);
+				rela[j].r_addend = v;
+				memset(p, 0, 4);
+			}
+		}
+	}
+	i = writefile(path, buf, len);
+	free(buf);
+	return i;
+}
+
+/* the size of executable sections in the object at path */
+static long elf_text(char *path)
+{
+	long len, n = 0;
+	char *buf = readfile(path, &len);
+	int i;
+	if (!buf)
+		return -1;
+	if (buf[EI_CLASS] == ELFCLASS64) {
+		Elf64_Ehdr *ehdr = (void *) buf;
+		Elf64_Shdr *shdr = (void *) (buf + ehdr->e_shoff);
+		for (i = 0; i < ehdr->e_shnum; i++)
+			if (shdr[i].sh_flags & SHF_EXECINSTR)
+				n += shdr[i].sh_size;
+	} else {
+		Elf32_Ehdr *ehdr = (void *) buf;
+		Elf32_Shdr *shdr = (void *) (buf + ehdr->e_shoff);
+		for (i = 0; i < ehdr->e_shnum; i++)
+			if (shdr[i].sh_flags & SHF_EXECINSTR)
+				n += shdr[i].sh_size;
+	}
+	free(buf);
+	return n;
+}
+
+/* run a shell command; return nonzero on failure */
+static int sh(char *fmt, char *a, char *b, char *c)
+{
+	char cmd[NCMD];
+	snprintf(cmd, sizeof(cmd), fmt, a, b, c);
+	if (system(cmd)) {
+		fprintf(stderr, "rtbench: failed: %s\n", cmd);
+		return 1;
+	}
+	return 0;
+}
+
+/* run path, writing its output to out; return its CPU time or -1 */
+static double run(char *path, char *out)
+{
+	struct rusage ru;
+	int pid, status;
+	if (!(pid = fork())) {
+		if (!freopen(out, "w", stdout))
+			_exit(127);
+		execl(path, path, NULL);
+		_exit(127);
+	}
+	if (pid < 0 || wait4(pid, &status, 0, &ru) < 0)
+		return -1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* the number of instructions executed by path or -1 */
+static long insns(char *path)
+{
+	char cmd[NCMD], line[512];
+	FILE *fp;
+	long n = -1;
+	snprintf(cmd, sizeof(cmd), "perf stat -x, -e instructions:u %s "
+		"2>&1 >/dev/null", path);
+	if (!(fp = popen(cmd, "r")))
+		return -1;
+	while (fgets(line, sizeof(line), fp))
+		if (strstr(line, "instructions") && line[0] >= '0' && line[0] <= '9')
+			n = atol(line);
+	pclose(fp);
+	return n;
+}
+
+static int bench(char *ncc, int runs)
+{
+	char src[NCMD], nobj[NCMD], cobj[NCMD], nexe[NCMD], cexe[NCMD];
+	int i, k;
+	printf("kernel\tncc_secs\tcc_secs\tratio\tncc_text\tcc_text"
+		"\tncc_insns\tcc_insns\n");
+	fflush(stdout);
+	for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		char *name = kernels[i];
+		double tn = -1, tc = -1;
+		long ln, lc;
+		char *on, *oc;
+		snprintf(src, sizeof(src), "%s/%s.c", rt_dir, name);
+		snprintf(nobj, sizeof(nobj), "%s.n.o", name);
+		snprintf(cobj, sizeof(cobj), "%s.c.o", name);
+		snprintf(nexe, sizeof(nexe), "./%s.n", name);
+		snprintf(cexe, sizeof(cexe), "./%s.c", name);
+		if (sh("%s -O2 -o %s %s", ncc, nobj, src) || elf_fixrela(nobj) ||
+				sh("%s -no-pie -o %s %s 2>/dev/null", rt_cc, nexe, nobj) ||
+				sh("%s -O2 -w -c -o %s %s", rt_cc, cobj, src) ||
+				sh("%s -no-pie -o %s %s", rt_cc, cexe, cobj))
+			return 1;
+		for (k = 0; k < runs; k++) {
+			double t1 = run(nexe, "rt.n.out");
+			double t2 = run(cexe, "rt.c.out");
+			if (t1 < 0 || t2 < 0) {
+				fprintf(stderr, "rtbench: %s failed\n", name);
+				return 1;
+			}
+			if (tn < 0 || t1 < tn)
+				tn = t1;
+			if (tc < 0 || t2 < tc)
+				tc = t2;
+		}
+		on = readfile("rt.n.out", &ln);
+		oc = readfile("rt.c.out", &lc);
+		if (!on || !oc || ln != lc || memcmp(on, oc, ln)) {
+			fprintf(stderr, "rtbench: %s: different outputs\n", name);
+			return 1;
+		}
+		free(on);
+		free(oc);
+		printf("%s\t%.3f\t%.3f\t%.2f\t%ld\t%ld\t%ld\t%ld\n", name, tn, tc,
+			tc > 0 ? tn / tc : 0, elf_text(nobj), elf_text(cobj),
+			insns(nexe), insns(cexe));
+		fflush(stdout);
+		unlink(nobj);
+		unlink(cobj);
+		unlink(nexe + 2);
+		unlink(cexe + 2);
+	}
+	unlink("rt.n.out");
+	unlink("rt.c.out");
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 4) {
+		fprintf(stderr, "usage: %s ncc cc dir [runs]\n", argv[0]);
+		return 1;
+	}
+	rt_cc = argv[2];
+	rt_dir = argv[3];
+	return bench(argv[1], argc > 4 ? atoi(argv[4]) : 3);
+}
@@ -0,0 +1,144 @@
+/* check the compile time growth for pathological inputs */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * Each input is generated at sizes n, 2n, 4n and 8n, where 8n is
+ * the size given in kinds[].  The growth exponent of the compile time
+ * between the smallest and the largest sizes (log(t8 / t1) / log(8))
+ * should not exceed the given limit.  For each input and size, a
+ * tab-separated line is printed with the time of the fastest run and,
+ * for the largest size, the exponent and whether it passed.
+ */
+
+#define NSIZES		4
+#define NPATH		1024
+
+static void gen_stmts(FILE *fp, long n)
+{
+	long i;
+	fprintf(fp, "int f(int *a, int x)\n{\n\tint y = x;\n");
+	for (i = 0; i < n; i++)
+		fprintf(fp, "\ty = a[%ld] + y * %ld;\n", i % 64, i % 7 + 1);
+	fprintf(fp, "\treturn y;\n}\n");
+}
+
+static void gen_globals(FILE *fp, long n)
+{
+	long i;
+	for (i = 0; i < n; i++)
+		fprintf(fp, "int g%ld = %ld;\n", i, i);
+	for (i = 0; i < n; i += 64)
+		fprintf(fp, "int f%ld(void)\n{\n\treturn g%ld + g%ld;\n}\n",
+			i, i, n - 1 - i);
+}
+
+static void gen_init(FILE *fp, long n)
+{
+	long i;
+	fprintf(fp, "int g;\nchar *names[] = {");
+	for (i = 0; i < n / 4; i++)
+		fprintf(fp, "%s\"s%ld\",", i % 8 ? " " : "\n\t", i % 512);
+	fprintf(fp, "\n};\nint *ptrs[] = {");
+	for (i = 0; i < n / 4; i++)
+		fprintf(fp, "%s&g,", i % 8 ? " " : "\n\t");
+	fprintf(fp, "\n};\nint nums[] = {");
+	for (i = 0; i < n / 2; i++)
+		fprintf(fp, "%s%ld,", i % 8 ? " " : "\n\t", i * 7);
+	fprintf(fp, "\n};\n");
+}
+
+static void gen_switch(FILE *fp, long n)
+{
+	long i;
+	fprintf(fp, "int f(int x)\n{\n\tswitch (x) {\n");
+	for (i = 0; i < n; i++)
+		fprintf(fp, "\tcase %ld:\n\t\treturn %ld;\n", i * 3, i);
+	fprintf(fp, "\t}\n\treturn -1;\n}\n");
+}
+
+static struct kind {
+	char *name;
+	void (*gen)(FILE *fp, long n);
+	long n;			/* the largest size */
+} kinds[] = {
+	{"stmts", gen_stmts, 100000},
+	{"globals", gen_globals, 50000},
+	{"init", gen_init, 100000},
+	{"switch", gen_switch, 10000},
+};
+
+/* compile path; return the time or -1 on failure */
+static double run(char *ncc, char *path, char *obj)
+{
+	struct timespec t0, t1;
+	int pid, status;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (!(pid = fork())) {
+		execl(ncc, ncc, "-o", obj, path, NULL);
+		_exit(127);
+	}
+	if (pid < 0 || waitpid(pid, &status, 0) < 0)
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return -1;
+	return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	char path[NPATH], obj[NPATH];
+	double t[NSIZES];
+	double limit;
+	int runs, failed = 0;
+	int i, j, k;
+	if (argc < 4) {
+		fprintf(stderr, "usage: %s ncc dir limit [runs]\n", argv[0]);
+		return 1;
+	}
+	limit = atof(argv[3]);
+	runs = argc > 4 ? atoi(argv[4]) : 1;
+	printf("input\tsize\tsecs\texponent\tresult\n");
+	for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		struct kind *kd = &kinds[i];
+		for (j = 0; j < NSIZES; j++) {
+			long n = kd->n >> (NSIZES - 1 - j);
+			FILE *fp;
+			snprintf(path, sizeof(path), "%s/%s%ld.c", argv[2], kd->name, n);
+			snprintf(obj, sizeof(obj), "%s/%s%ld.o", argv[2], kd->name, n);
+			if (!(fp = fopen(path, "w"))) {
+				fprintf(stderr, "scale: cannot create <%s>\n", path);
+				return 1;
+			}
+			kd->gen(fp, n);
+			fclose(fp);
+			t[j] = -1;
+			for (k = 0; k < runs; k++) {
+				double d = run(argv[1], path, obj);
+				if (d < 0) {
+					fprintf(stderr, "scale: %s failed\n", path);
+					return 1;
+				}
+				if (t[j] < 0 || d < t[j])
+					t[j] = d;
+			}
+			unlink(obj);
+			unlink(path);
+			printf("%s\t%ld\t%.4f", kd->name, n, t[j]);
+			if (j == NSIZES - 1) {
+				double e = log(t[j] / t[0]) / log(1 << (NSIZES - 1));
+				printf("\t%.2f\t%s", e, e > limit ? "FAIL" : "ok");
+				failed += e > limit;
+			}
+			printf("\n");
+			fflush(stdout);
+		}
+	}
+	return failed != 0;
+}
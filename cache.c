@@ -0,0 +1,364 @@
+/* neatcc object cache */
+#include <dirent.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "ncc.h"
+
+/*
+ * Entries are stored in the cache directory as xx/key.o, in which key
+ * is an MD5 digest and xx is its first two digits.  For objects, the
+ * digest covers the preprocessed source and for the code of functions
+ * (see gen.c), their intermediate code; both include the optimization
+ * level, the target architecture and the compiler executable.
+ * Entries are inserted by renaming temporary files, so concurrent
+ * compilers never see partial objects.  The modification time of an
+ * entry is updated on each hit; when a subdirectory exceeds its share
+ * of the size limit, its least recently used entries are removed.
+ */
+
+#define NSUBDIRS	256		/* number of cache subdirectories */
+
+static char cache_path[512];	/* cache directory */
+static long cache_max;		/* cache size limit */
+static char cache_exe[64];	/* the digest of the compiler executable */
+
+/* MD5 (RFC 1321) */
+struct md5 {
+	unsigned s[4];		/* state */
+	unsigned char b[64];	/* pending input */
+	long n;			/* total input length */
+};
+
+/* the integer part of abs(sin(i + 1)) * 2^32 */
+static unsigned md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+/* per-round shift amounts */
+static int md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void md5_init(struct md5 *m)
+{
+	m->s[0] = 0x67452301;
+	m->s[1] = 0xefcdab89;
+	m->s[2] = 0x98badcfe;
+	m->s[3] = 0x10325476;
+	m->n = 0;
+}
+
+static void md5_block(struct md5 *m, unsigned char *b)
+{
+	unsigned w[16];
+	unsigned a = m->s[0], bb = m->s[1], c = m->s[2], d = m->s[3];
+	unsigned f, t;
+	int i, g;
+	for (i = 0; i < 16; i++)
+		w[i] = b[i * 4] | (b[i * 4 + 1] << 8) |
+			(b[i * 4 + 2] << 16) | ((unsigned) b[i * 4 + 3] << 24);
+	for (i = 0; i < 64; i++) {
+		if (i < 16) {
+			f = (bb & c) | (~bb & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & bb) | (~d & c);
+			g = (5 * i + 1) & 15;
+		} else if (i < 48) {
+			f = bb ^ c ^ d;
+			g = (3 * i + 5) & 15;
+		} else {
+			f = c ^ (bb | ~d);
+			g = (7 * i) & 15;
+		}
+		t = d;
+		d = c;
+		c = bb;
+		f = a + f + md5_k[i] + w[g];
+		bb = bb + ((f << md5_r[i]) | (f >> (32 - md5_r[i])));
+		a = t;
+	}
+	m->s[0] += a;
+	m->s[1] += bb;
+	m->s[2] += c;
+	m->s[3] += d;
+}
+
+static void md5_put(struct md5 *m, void *buf, long len)
+{
+	unsigned char *s = buf;
+	while (len > 0) {
+		int o = m->n & 63;
+		int n = MIN(64 - o, len);
+		memcpy(m->b + o, s, n);
+		m->n += n;
+		s += n;
+		len -= n;
+		if (!(m->n & 63))
+			md5_block(m, m->b);
+	}
+}
+
+/* finish the digest and store it in hex in key */
+static void md5_hex(struct md5 *m, char *key)
+{
+	unsigned char pad[72] = {0x80};
+	long bits = m->n * 8;
+	int i;
+	md5_put(m, pad, ((55 - m->n) & 63) + 1);
+	for (i = 0; i < 8; i++)
+		pad[i] = i < sizeof(bits) ? (bits >> (i * 8)) & 0xff : 0;
+	md5_put(m, pad, 8);
+	for (i = 0; i < 16; i++)
+		sprintf(key + i * 2, "%02x", (m->s[i / 4] >> (i % 4 * 8)) & 0xff);
+}
+
+/* hash the output of the preprocessor for path in a child process */
+static int cache_src(char *path, struct md5 *m)
+{
+	char *cbuf;
+	long clen;
+	int fds[2];
+	int pid, status, bad;
+	if (pipe(fds) || (pid = fork()) < 0)
+		return 1;
+	if (!pid) {
+		char msg[512];
+		jmp_buf env;
+		close(fds[0]);
+		if (setjmp(env))
+			_exit(1);
+		die_catch(&env, msg);
+		if (cpp_init(path))
+			_exit(1);
+		while (!cpp_read(&cbuf, &clen))
+			md5_put(m, cbuf, clen);
+		write(fds[1], m, sizeof(*m));
+		_exit(0);
+	}
+	close(fds[1]);
+	bad = read(fds[0], m, sizeof(*m)) != sizeof(*m);
+	close(fds[0]);
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status))
+		return 1;
+	return bad;
+}
+
+/* use dir as the cache, limiting its size to max bytes */
+void cache_set(char *dir, long max)
+{
+	struct md5 m;
+	char buf[1 << 14];
+	long n;
+	int fd;
+	snprintf(cache_path, sizeof(cache_path), "%s", dir);
+	cache_max = max;
+	md5_init(&m);
+	if ((fd = open("/proc/self/exe", O_RDONLY)) >= 0) {
+		while ((n = read(fd, buf, sizeof(buf))) > 0)
+			md5_put(&m, buf, n);
+		close(fd);
+	}
+	md5_hex(&m, cache_exe);
+}
+
+/* add the compiler options to the digest and store it in key */
+static void cache_digest(struct md5 *m, char *key)
+{
+	char opts[128];
+	int level = 0;
+	while (level < 16 && opt(level + 1))
+		level++;
+	sprintf(opts, "-O%d %s %d %s", level, I_ARCH, LONGSZ, cache_exe);
+	md5_put(m, opts, strlen(opts) + 1);
+	md5_hex(m, key);
+}
+
+/* compute the cache key of the source file path; return nonzero on error */
+int cache_key(char *path, char *key)
+{
+	struct md5 m;
+	md5_init(&m);
+	if (!cache_path[0] || cache_src(path, &m))
+		return 1;
+	cache_digest(&m, key);
+	return 0;
+}
+
+/* compute the cache key of buf; kind distinguishes different entries */
+int cache_hash(char *kind, void *buf, long len, char *key)
+{
+	struct md5 m;
+	if (!cache_path[0])
+		return 1;
+	md5_init(&m);
+	md5_put(&m, kind, strlen(kind) + 1);
+	md5_put(&m, buf, len);
+	cache_digest(&m, key);
+	return 0;
+}
+
+static void cache_file(char *key, char *path)
+{
+	sprintf(path, "%s/%c%c/%s.o", cache_path, key[0], key[1], key);
+}
+
+/* copy the cached object of key to file out; return nonzero on failure */
+int cache_get(char *key, char *out)
+{
+	char path[1024];
+	char buf[1 << 14];
+	long n, nw, nr;
+	int ifd, ofd;
+	cache_file(key, path);
+	if ((ifd = open(path, O_RDONLY)) < 0)
+		return 1;
+	if ((ofd = open(out, O_WRONLY | O_TRUNC | O_CREAT, 0600)) < 0) {
+		close(ifd);
+		return 1;
+	}
+	while ((nr = read(ifd, buf, sizeof(buf))) > 0) {
+		for (nw = 0; nw < nr && (n = write(ofd, buf + nw, nr - nw)) > 0;)
+			nw += n;
+		if (nw < nr)
+			break;
+	}
+	close(ifd);
+	if (close(ofd) || nr) {
+		unlink(out);
+		return 1;
+	}
+	utime(path, NULL);
+	return 0;
+}
+
+/* read the entry of key into mem; return nonzero if missing */
+int cache_load(char *key, struct mem *mem)
+{
+	char path[1024];
+	char buf[1 << 12];
+	long n;
+	int fd;
+	cache_file(key, path);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 1;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		mem_put(mem, buf, n);
+	close(fd);
+	utime(path, NULL);
+	return 0;
+}
+
+/* an entry of a cache subdirectory */
+struct ent {
+	char name[NAMELEN];
+	long size;
+	long time;
+};
+
+static int ent_cmp(const void *a, const void *b)
+{
+	long t1 = ((struct ent *) a)->time;
+	long t2 = ((struct ent *) b)->time;
+	return t1 < t2 ? -1 : t1 > t2;
+}
+
+/* remove least recently used entries of subdirectory dir, except keep */
+static void cache_evict(char *dir, char *keep)
+{
+	struct ent *ents = NULL;
+	long ents_n = 0, ents_sz = 0;
+	long size = 0;
+	long max = cache_max / NSUBDIRS;
+	char path[1024];
+	struct dirent *de;
+	struct stat st;
+	DIR *d;
+	long i;
+	if (!(d = opendir(dir)))
+		return;
+	while ((de = readdir(d))) {
+		if (de->d_name[0] == '.' || strlen(de->d_name) >= NAMELEN)
+			continue;
+		if (!strncmp(de->d_name, keep, strlen(keep)))
+			continue;
+		sprintf(path, "%s/%s", dir, de->d_name);
+		if (stat(path, &st))
+			continue;
+		if (ents_n == ents_sz) {
+			ents_sz = MAX(128, ents_sz * 2);
+			ents = mextend(ents, ents_n, ents_sz, sizeof(ents[0]));
+		}
+		strcpy(ents[ents_n].name, de->d_name);
+		ents[ents_n].size = st.st_size;
+		ents[ents_n].time = st.st_mtime;
+		size += st.st_size;
+		ents_n++;
+	}
+	closedir(d);
+	if (size <= max) {
+		free(ents);
+		return;
+	}
+	/* removing the oldest entries until 90% of the limit is left */
+	qsort(ents, ents_n, sizeof(ents[0]), ent_cmp);
+	for (i = 0; i < ents_n && size > max - max / 10; i++) {
+		sprintf(path, "%s/%s", dir, ents[i].name);
+		unlink(path);
+		size -= ents[i].size;
+	}
+	free(ents);
+}
+
+/* insert the entry of key into the cache */
+void cache_put(char *key, char *buf, long len)
+{
+	char dir[768];
+	char tmp[1024];
+	char path[1024];
+	long nw = 0, n;
+	int fd;
+	sprintf(dir, "%s/%c%c", cache_path, key[0], key[1]);
+	mkdir(cache_path, 0777);
+	mkdir(dir, 0777);
+	sprintf(tmp, "%s/%s.%d.tmp", dir, key, getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		return;
+	while (nw < len && (n = write(fd, buf + nw, len - nw)) > 0)
+		nw += n;
+	close(fd);
+	cache_file(key, path);
+	if (nw < len || rename(tmp, path)) {
+		unlink(tmp);
+		return;
+	}
+	if (cache_max > 0)
+		cache_evict(dir, key);
+}
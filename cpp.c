@@ -1,12 +1,15 @@
 /* neatcc preprocessor */
 #include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "ncc.h"
@@ -15,17 +18,25 @@ static char *buf;
 static long len;
 static long cur;
 
+#define MPOOLSZ		(1 << 16)	/* the size of mpool[] blocks */
+
 static struct macro {
-	char name[NAMELEN];	/* macro name */
-	char def[MDEFLEN];	/* macro definition */
-	char args[NARGS][NAMELEN];
+	char *name;		/* macro name */
+	char *def;		/* macro definition */
+	char **args;		/* argument names */
 	int nargs;		/* number of arguments */
 	int isfunc;		/* macro is a function */
 	int undef;		/* macro is removed */
-} macros[NDEFS];
-static int mcount = 1;		/* number of macros */
-static int mhead[256];		/* macro hash table heads */
-static int mnext[NDEFS];	/* macro hash table next entries */
+} *macros;
+static int mcount;		/* number of macros */
+static int msize;		/* the size of macros[] */
+static struct htab mtab;	/* macros[] hash table */
+
+/* the names, definitions and arguments of macros are allocated in mpool */
+static char **mpool;		/* allocated blocks */
+static int mpool_n, mpool_sz;	/* number of blocks in mpool[] */
+static char *mpool_cur;		/* free memory in the last block */
+static long mpool_left;		/* the size of mpool_cur */
 
 #define BUF_FILE		0
 #define BUF_MACRO		1
@@ -41,8 +52,10 @@ static struct buf {
 	int type;
 	/* for BUF_FILE */
 	char path[NAMELEN];
+	int inc;			/* incs[] index or -1 */
+	long maplen;			/* mmap()ed size; 0 if malloc()ed, -1 if shared */
 	/* for BUF_MACRO */
-	struct macro *macro;
+	int macro;			/* macros[] index; it may move */
 	char args[NARGS][MARGLEN];	/* arguments passed to a macro */
 	/* for BUF_ARG */
 	int arg_buf;			/* the bufs index of the owning macro */
@@ -50,6 +63,16 @@ static struct buf {
 static int bufs_n;
 static int bufs_limit = 0;		/* cpp_read() limit; useful in cpp_eval() */
 
+static jmp_buf *die_env;		/* where die() jumps instead of exiting */
+static char *die_msg;		/* the message of die() for die_env */
+
+/* make die() copy its message to msg and jump to env, if not NULL */
+void die_catch(void *env, char *msg)
+{
+	die_env = env;
+	die_msg = msg;
+}
+
 void die(char *fmt, ...)
 {
 	va_list ap;
@@ -57,6 +80,10 @@ void die(char *fmt, ...)
 	va_start(ap, fmt);
 	vsprintf(msg, fmt, ap);
 	va_end(ap);
+	if (die_env) {
+		strcpy(die_msg, msg);
+		longjmp(*die_env, 1);
+	}
 	write(2, msg, strlen(msg));
 	exit(1);
 }
@@ -77,10 +104,12 @@ static void buf_new(int type, char *dat, long dlen)
 	bufs[bufs_n - 1].type = type;
 }
 
-static void buf_file(char *path, char *dat, int dlen)
+static void buf_file(char *path, char *dat, long dlen)
 {
 	buf_new(BUF_FILE, dat, dlen);
 	strcpy(bufs[bufs_n - 1].path, path ? path : "");
+	bufs[bufs_n - 1].inc = -1;
+	bufs[bufs_n - 1].maplen = 0;
 }
 
 static int macro_arg(struct macro *m, char *arg);
@@ -140,7 +169,7 @@ static void buf_macro(struct macro *m)
 	len = mem_len(&mem);
 	buf_new(BUF_MACRO, mem_get(&mem), len);
 	mem_done(&mem);
-	bufs[bufs_n - 1].macro = m;
+	bufs[bufs_n - 1].macro = m - macros;
 }
 
 static void buf_arg(char *arg, int mbuf)
@@ -151,8 +180,10 @@ static void buf_arg(char *arg, int mbuf)
 
 static void buf_pop(void)
 {
-	bufs_n--;
-	if (bufs[bufs_n].type == BUF_FILE || bufs[bufs_n].type == BUF_MACRO)
+	struct buf *b = &bufs[--bufs_n];
+	if (b->type == BUF_FILE && b->maplen > 0)
+		munmap(buf, b->maplen);
+	else if ((b->type == BUF_FILE && !b->maplen) || b->type == BUF_MACRO)
 		free(buf);
 	if (bufs_n) {
 		cur = bufs[bufs_n - 1].cur;
@@ -170,35 +201,382 @@ static int buf_iseval(void)
 	return 0;
 }
 
-static size_t file_size(int fd)
+/*
+ * Map the regular file fd of size n, followed by a null byte: pages
+ * after the end of the file are zero-filled and, if its size is a
+ * multiple of the page size, the anonymous mapping below it supplies
+ * the null byte.  Return NULL on failure.
+ */
+static char *file_map(int fd, long n, long *maplen)
+{
+	long sz = ALIGN(n + 1, sysconf(_SC_PAGESIZE));
+	char *map = mmap(NULL, sz, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	if (mmap(map, n, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(map, sz);
+		return NULL;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(map, n, MADV_SEQUENTIAL);
+#endif
+	*maplen = sz;
+	return map;
+}
+
+/* read fd till its end; for pipes and files that cannot be mapped */
+static char *file_read(int fd, long *n)
+{
+	struct mem mem;
+	char chunk[1 << 12];
+	long nr;
+	mem_init(&mem);
+	while ((nr = read(fd, chunk, sizeof(chunk))) > 0)
+		mem_put(&mem, chunk, nr);
+	*n = mem_len(&mem);
+	mem_putc(&mem, '\0');
+	mem_cut(&mem, *n);
+	return mem_get(&mem);
+}
+
+/*
+ * The compile server keeps the contents of the files read by its jobs
+ * in fc[] and each job, running in a child of the server, uses them
+ * instead of reading the files again.  Entries are checked once per
+ * job: files by their modification time (with nanoseconds), size and
+ * inode and missing files by the modification time of their directory.
+ * Jobs report the files they read or fail to find through fc_fd, so
+ * that the server can add them to fc[].
+ */
+#define FC_FILE		0	/* a file and its contents */
+#define FC_NONE		1	/* a missing file */
+#define FC_DIR		2	/* a directory of missing files */
+
+static struct fc {
+	char *path;		/* absolute path */
+	int type;		/* entry type (FC_*) */
+	char *dat;		/* file contents */
+	long len;		/* file length */
+	long mtime, mtimens;	/* modification time */
+	long size;		/* file size */
+	long dev, ino;		/* file identity */
+	int ok;			/* checked in this job */
+} *fc;
+static int fc_n, fc_sz;
+static struct htab fc_tab;	/* fc[] hash table */
+static int fc_fd = -1;		/* reporting the files read to the server */
+static char fc_cwd[PATH_MAX];	/* current working directory */
+
+static int fc_find(char *path, int type)
+{
+	int i;
+	for (i = htab_get(&fc_tab, hash(path)); i >= 0;
+			i = htab_next(&fc_tab, i))
+		if (fc[i].type == type && !strcmp(fc[i].path, path))
+			return i;
+	return -1;
+}
+
+static int fc_add(char *path, int type)
+{
+	int i = fc_find(path, type);
+	if (i >= 0) {
+		free(fc[i].dat);
+		fc[i].dat = NULL;
+		fc[i].ok = 0;
+		return i;
+	}
+	if (fc_n >= fc_sz) {
+		fc_sz = MAX(128, fc_sz * 2);
+		fc = mextend(fc, fc_n, fc_sz, sizeof(fc[0]));
+	}
+	i = fc_n++;
+	fc[i].path = malloc(strlen(path) + 1);
+	strcpy(fc[i].path, path);
+	fc[i].type = type;
+	fc[i].dat = NULL;
+	fc[i].ok = 0;
+	htab_put(&fc_tab, hash(path));
+	return i;
+}
+
+/* the directory of path; a static buffer */
+static char *fc_dir(char *path)
+{
+	static char dir[PATH_MAX];
+	char *s;
+	snprintf(dir, sizeof(dir), "%s", path);
+	s = strrchr(dir, '/');
+	*(s == dir ? s + 1 : s) = '\0';
+	return dir;
+}
+
+/* the FC_DIR entry of directory dir, checked once per job */
+static int fc_dirent(char *dir)
 {
 	struct stat st;
-	if (!fstat(fd, &st))
-		return st.st_size;
-	return 0;
+	int i = fc_find(dir, FC_DIR);
+	if (i >= 0 && fc[i].ok)
+		return i;
+	if (i < 0)
+		i = fc_add(dir, FC_DIR);
+	fc[i].mtime = -1;
+	fc[i].mtimens = 0;
+	if (!stat(dir, &st)) {
+		fc[i].mtime = st.st_mtime;
+		fc[i].mtimens = st.st_mtim.tv_nsec;
+	}
+	fc[i].ok = 1;
+	return i;
 }
 
-static int include_file(char *path)
+/* return nonzero if fc[i] is still valid */
+static int fc_check(int i)
 {
-	int fd = open(path, O_RDONLY);
-	int n = 0, nr = 0;
-	char *dat;
-	int size;
-	if (fd == -1)
-		return -1;
-	size = file_size(fd) + 1;
-	dat = malloc(size);
-	while ((n = read(fd, dat + nr, size - nr)) > 0)
+	struct stat st;
+	int d;
+	if (!fc[i].ok && fc[i].type == FC_FILE)
+		fc[i].ok = !stat(fc[i].path, &st) && st.st_mtime == fc[i].mtime &&
+			st.st_mtim.tv_nsec == fc[i].mtimens &&
+			st.st_size == fc[i].size && st.st_ino == fc[i].ino &&
+			st.st_dev == fc[i].dev;
+	if (!fc[i].ok && fc[i].type == FC_NONE) {
+		d = fc_dirent(fc_dir(fc[i].path));
+		fc[i].ok = fc[d].mtime == fc[i].mtime &&
+			fc[d].mtimens == fc[i].mtimens;
+	}
+	return fc[i].ok;
+}
+
+/* the absolute path of path in abs[PATH_MAX]; nonzero if too long */
+static int fc_abspath(char *path, char *abs)
+{
+	if (path[0] != '/' && !fc_cwd[0] && !getcwd(fc_cwd, sizeof(fc_cwd)))
+		strcpy(fc_cwd, ".");
+	if (path[0] == '/')
+		return snprintf(abs, PATH_MAX, "%s", path) >= PATH_MAX;
+	return snprintf(abs, PATH_MAX, "%s/%s", fc_cwd, path) >= PATH_MAX;
+}
+
+/* report the files read or missing to the server */
+static void fc_report(int found, char *abs)
+{
+	char msg[PATH_MAX + 4];
+	snprintf(msg, sizeof(msg), "%c %s\n", found ? 'f' : 'm', abs);
+	write(fc_fd, msg, strlen(msg));
+}
+
+/* jobs of the compile server report the files they read to fd */
+void cpp_report(int fd)
+{
+	fc_fd = fd;
+}
+
+/* add the file at absolute path to the file cache of the server */
+void cpp_cache(char *path, int found)
+{
+	struct stat st;
+	int fd, i;
+	long nr = 0, n;
+	if (!found) {
+		int d;
+		i = fc_add(path, FC_NONE);
+		d = fc_dirent(fc_dir(path));
+		fc[i].mtime = fc[d].mtime;
+		fc[i].mtimens = fc[d].mtimens;
+		fc[d].ok = 0;
+		return;
+	}
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st)) {
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	i = fc_add(path, FC_FILE);
+	fc[i].dat = malloc(st.st_size + 1);
+	while (nr < st.st_size && (n = read(fd, fc[i].dat + nr, st.st_size - nr)) > 0)
 		nr += n;
 	close(fd);
-	dat[nr] = '\0';
-	buf_file(path, dat, nr);
+	fc[i].dat[nr] = '\0';
+	fc[i].len = nr;
+	fc[i].mtime = st.st_mtime;
+	fc[i].mtimens = st.st_mtim.tv_nsec;
+	fc[i].size = st.st_size;
+	fc[i].dev = st.st_dev;
+	fc[i].ino = st.st_ino;
+}
+
+/*
+ * Headers included before are skipped without reading them, if they
+ * contain #pragma once or if their contents are wrapped in #ifndef X
+ * and #endif and macro X is defined.  Headers are identified by their
+ * device and inode numbers, so the same header reached through
+ * different paths (for instance via ".." or symbolic links) is
+ * recognized.
+ */
+static struct inc {
+	long dev, ino;		/* header identity */
+	char *guard;		/* include guard macro or NULL */
+	unsigned hash;		/* the hash of guard */
+	int once;		/* the header contains #pragma once */
+} *incs;
+static int incs_n, incs_sz;
+static struct htab incs_tab;	/* incs[] hash table */
+
+static int jumpws(void);
+static int jumpcomment(void);
+static int jumpstr(void);
+static unsigned read_word(char *dst);
+static int macro_find(char *name, unsigned h, int undef);
+
+static int inc_find(long dev, long ino)
+{
+	int i;
+	for (i = htab_get(&incs_tab, ino ^ dev); i >= 0;
+			i = htab_next(&incs_tab, i))
+		if (incs[i].ino == ino && incs[i].dev == dev)
+			return i;
+	return -1;
+}
+
+/* whether the current file is wrapped in #ifndef name and #endif */
+static int inc_guarded(char *name, unsigned *hash)
+{
+	char cmd[NAMELEN];
+	int depth = 0;
+	while (cur < len && (!jumpws() || !jumpcomment()))
+		;
+	if (buf[cur] != '#')
+		return 0;
+	cur++;
+	read_word(cmd);
+	if (strcmp("ifndef", cmd))
+		return 0;
+	*hash = read_word(name);
+	if (!name[0])
+		return 0;
+	while (cur < len) {
+		if (buf[cur] == '#') {
+			cur++;
+			read_word(cmd);
+			if (!strcmp("ifdef", cmd) || !strcmp("ifndef", cmd) ||
+					!strcmp("if", cmd))
+				depth++;
+			if (!depth && (!strcmp("else", cmd) || !strcmp("elif", cmd)))
+				return 0;
+			if (!strcmp("endif", cmd) && !depth--)
+				break;
+			continue;
+		}
+		if (!jumpcomment() || !jumpstr())
+			continue;
+		cur++;
+	}
+	if (depth >= 0)
+		return 0;
+	while (cur < len && (!jumpws() || !jumpcomment()))
+		;
+	return cur >= len;
+}
+
+/* record the file just pushed by include_file() in incs[] */
+static int inc_add(long dev, long ino)
+{
+	char guard[NAMELEN];
+	int i = inc_find(dev, ino);
+	if (i < 0) {
+		if (incs_n >= incs_sz) {
+			incs_sz = MAX(128, incs_sz * 2);
+			incs = mextend(incs, incs_n, incs_sz, sizeof(incs[0]));
+		}
+		i = incs_n++;
+		incs[i].dev = dev;
+		incs[i].ino = ino;
+		incs[i].guard = NULL;
+		incs[i].once = 0;
+		if (inc_guarded(guard, &incs[i].hash)) {
+			incs[i].guard = malloc(strlen(guard) + 1);
+			strcpy(incs[i].guard, guard);
+		}
+		cur = 0;
+		htab_put(&incs_tab, ino ^ dev);
+	}
+	bufs[bufs_n - 1].inc = i;
+	return i;
+}
+
+/* whether including incs[i] again has no effect */
+static int inc_skip(int i)
+{
+	if (incs[i].once)
+		return 1;
+	return incs[i].guard && macro_find(incs[i].guard, incs[i].hash, 0) >= 0;
+}
+
+/* include path; store its incs[] index in inc, or -1 if unknown */
+static int include_file(char *path, int *inc)
+{
+	struct stat st;
+	int fd, ok;
+	char *dat = NULL;
+	long n, maplen = 0;
+	char abs[PATH_MAX];
+	/* files with paths longer than PATH_MAX are not cached */
+	int report = fc_fd >= 0 && !fc_abspath(path, abs);
+	*inc = -1;
+	if (report) {
+		int i;
+		if ((i = fc_find(abs, FC_FILE)) >= 0 && fc_check(i)) {
+			*inc = inc_find(fc[i].dev, fc[i].ino);
+			if (*inc >= 0 && inc_skip(*inc))
+				return 0;
+			buf_file(path, fc[i].dat, fc[i].len);
+			bufs[bufs_n - 1].maplen = -1;
+			*inc = inc_add(fc[i].dev, fc[i].ino);
+			return 0;
+		}
+		if ((i = fc_find(abs, FC_NONE)) >= 0 && fc_check(i))
+			return -1;
+	}
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (report)
+			fc_report(0, abs);
+		return -1;
+	}
+	ok = !fstat(fd, &st);
+	if (ok && (*inc = inc_find(st.st_dev, st.st_ino)) >= 0 &&
+			inc_skip(*inc)) {
+		close(fd);
+		return 0;
+	}
+	if (ok && S_ISREG(st.st_mode) && st.st_size > 0)
+		dat = file_map(fd, n = st.st_size, &maplen);
+	if (!dat)
+		dat = file_read(fd, &n);
+	close(fd);
+	buf_file(path, dat, n);
+	bufs[bufs_n - 1].maplen = maplen;
+	if (ok)
+		*inc = inc_add(st.st_dev, st.st_ino);
+	if (report)
+		fc_report(1, abs);
 	return 0;
 }
 
 int cpp_init(char *path)
 {
-	return include_file(path);
+	int inc;
+	return include_file(path, &inc);
+}
+
+/* read the source from src instead of a file; path is used in messages */
+void cpp_initbuf(char *path, char *src, long len)
+{
+	char *dat = malloc(len + 1);
+	memcpy(dat, src, len);
+	dat[len] = '\0';
+	buf_file(path, dat, len);
 }
 
 static int jumpws(void)
@@ -209,12 +587,18 @@ static int jumpws(void)
 	return cur == old;
 }
 
-static void read_word(char *dst)
+/* read an identifier and return its hash() */
+static unsigned read_word(char *dst)
 {
+	char *s = dst;
 	jumpws();
-	while (cur < len && (isalnum(buf[cur]) || buf[cur] == '_'))
+	while (cur < len && (isalnum(buf[cur]) || buf[cur] == '_')) {
+		if (dst - s >= NAMELEN - 1)
+			err("identifier too long\n");
 		*dst++ = buf[cur++];
+	}
 	*dst = '\0';
+	return hash(s);
 }
 
 static int jumpcomment(void)
@@ -226,11 +610,13 @@ static int jumpcomment(void)
 				return 0;
 			}
 		}
+		return 0;
 	}
 	if (buf[cur] == '/' && buf[cur + 1] == '/') {
 		while (++cur < len && buf[cur] != '\n')
 			if (buf[cur] == '\\')
 				cur++;
+		cur = MIN(cur, len);
 		return 0;
 	}
 	return 1;
@@ -242,20 +628,20 @@ static int jumpstr(void)
 		while (++cur < len && buf[cur] != '\'')
 			if (buf[cur] == '\\')
 				cur++;
-		cur++;
+		cur = cur < len ? cur + 1 : len;
 		return 0;
 	}
 	if (buf[cur] == '"') {
 		while (++cur < len && buf[cur] != '"')
 			if (buf[cur] == '\\')
 				cur++;
-		cur++;
+		cur = cur < len ? cur + 1 : len;
 		return 0;
 	}
 	return 1;
 }
 
-static void read_tilleol(char *dst)
+static void read_tilleol(struct mem *dst)
 {
 	while (cur < len && isspace(buf[cur]) && buf[cur] != '\n')
 		cur++;
@@ -266,42 +652,115 @@ static void read_tilleol(char *dst)
 			continue;
 		}
 		if (!jumpstr()) {
-			memcpy(dst, buf + last, cur - last);
-			dst += cur - last;
+			mem_put(dst, buf + last, cur - last);
 			continue;
 		}
 		if (!jumpcomment())
 			continue;
-		*dst++ = buf[cur++];
+		mem_putc(dst, (unsigned char) buf[cur++]);
 	}
-	*dst = '\0';
 }
 
 static char *locs[NLOCS] = {};
 static int nlocs = 0;
+static int locs_stat[NLOCS];	/* 1 if locs[i] exists, -1 if not, 0 if unknown */
 
 /* header directory */
 void cpp_path(char *s)
 {
+	locs_stat[nlocs] = 0;
 	locs[nlocs++] = s;
 }
 
-static int include_find(char *name, int std)
+/*
+ * The search directory in which each included name was found, or -1
+ * if it was not found, so that searching the directories is done once
+ * for each name.  The header found is remembered too, so that including
+ * a guarded or #pragma once header again through the same name needs
+ * no system calls.
+ */
+static struct ipath {
+	char *name;		/* included name */
+	int std;		/* included with <> */
+	int loc;		/* locs[] index or -1 */
+	int inc;		/* incs[] index of the header found or -1 */
+} *ipaths;
+static int ipaths_n, ipaths_sz;
+static struct htab ipaths_tab;	/* ipaths[] hash table */
+
+static int ipath_find(char *name, int std)
 {
 	int i;
-	for (i = std ? nlocs - 1 : nlocs; i >= 0; i--) {
-		char path[1 << 10];
-		if (locs[i])
-			sprintf(path, "%s/%s", locs[i], name);
-		else
-			strcpy(path, name);
-		if (!include_file(path))
+	for (i = htab_get(&ipaths_tab, hash(name)); i >= 0;
+			i = htab_next(&ipaths_tab, i))
+		if (ipaths[i].std == std && !strcmp(ipaths[i].name, name))
+			return i;
+	return -1;
+}
+
+static int ipath_add(char *name, int std)
+{
+	int i;
+	if (ipaths_n >= ipaths_sz) {
+		ipaths_sz = MAX(128, ipaths_sz * 2);
+		ipaths = mextend(ipaths, ipaths_n, ipaths_sz, sizeof(ipaths[0]));
+	}
+	i = ipaths_n++;
+	ipaths[i].name = malloc(strlen(name) + 1);
+	strcpy(ipaths[i].name, name);
+	ipaths[i].std = std;
+	ipaths[i].inc = -1;
+	htab_put(&ipaths_tab, hash(name));
+	return i;
+}
+
+/* whether search directory locs[i] is missing; checked once */
+static int loc_missing(int i)
+{
+	struct stat st;
+	if (locs[i] && !locs_stat[i])
+		locs_stat[i] = stat(locs[i], &st) ? -1 : 1;
+	return locs[i] && locs_stat[i] < 0;
+}
+
+/* the path of name in search directory locs[loc]; nonzero if too long */
+static int include_path(char *path, char *name, int loc)
+{
+	if (locs[loc])
+		return snprintf(path, PATH_MAX, "%s/%s",
+				locs[loc], name) >= PATH_MAX;
+	return snprintf(path, PATH_MAX, "%s", name) >= PATH_MAX;
+}
+
+static int include_find(char *name, int std)
+{
+	char path[PATH_MAX];
+	int e = ipath_find(name, std);
+	int i, inc = -1;
+	if (e >= 0 && ipaths[e].loc < 0)
+		return -1;
+	if (e >= 0 && ipaths[e].inc >= 0 && inc_skip(ipaths[e].inc))
+		return 0;
+	if (e >= 0) {
+		if (!include_path(path, name, ipaths[e].loc) &&
+				!include_file(path, &ipaths[e].inc))
 			return 0;
 	}
-	return -1;
+	/* not searched yet or removed since */
+	for (i = std ? nlocs - 1 : nlocs; i >= 0; i--) {
+		if (loc_missing(i))
+			continue;
+		if (!include_path(path, name, i) && !include_file(path, &inc))
+			break;
+	}
+	if (e < 0)
+		e = ipath_add(name, std);
+	ipaths[e].loc = i;
+	ipaths[e].inc = inc;
+	return i >= 0 ? 0 : -1;
 }
 
-static void readarg(char *s)
+static void readarg(char *s, int sz)
 {
 	int depth = 0;
 	int beg = cur;
@@ -322,96 +781,139 @@ static void readarg(char *s)
 		}
 	}
 	if (s) {
+		if (cur - beg >= sz)
+			err("macro argument too long\n");
 		memcpy(s, buf + beg, cur - beg);
 		s[cur - beg] = '\0';
 	}
 }
 
-/* find a macro; if undef is nonzero, search #undef-ed macros too */
-static int macro_find(char *name, int undef)
+/* allocate n bytes for a macro; released in cpp_done() */
+static void *macro_alloc(long n)
 {
-	int i = mhead[(unsigned char) name[0]];
-	while (i > 0) {
+	void *ret;
+	n = ALIGN(n, sizeof(char *));
+	if (n > mpool_left) {
+		if (mpool_n >= mpool_sz) {
+			mpool_sz = MAX(16, mpool_sz * 2);
+			mpool = mextend(mpool, mpool_n, mpool_sz, sizeof(mpool[0]));
+		}
+		mpool_left = MAX(n, MPOOLSZ);
+		mpool_cur = malloc(mpool_left);
+		mpool[mpool_n++] = mpool_cur;
+	}
+	ret = mpool_cur;
+	mpool_cur += n;
+	mpool_left -= n;
+	return ret;
+}
+
+static char *macro_str(char *s, long n)
+{
+	char *d = macro_alloc(n + 1);
+	memcpy(d, s, n);
+	d[n] = '\0';
+	return d;
+}
+
+/* find a macro with hash h; if undef is nonzero, search #undef-ed macros too */
+static int macro_find(char *name, unsigned h, int undef)
+{
+	int i;
+	for (i = htab_get(&mtab, h); i >= 0; i = htab_next(&mtab, i))
 		if (!strcmp(name, macros[i].name))
 			if (!macros[i].undef || undef)
 				return i;
-		i = mnext[i];
-	}
 	return -1;
 }
 
-static void macro_undef(char *name)
+static void macro_undef(char *name, unsigned h)
 {
-	int i = macro_find(name, 0);
+	int i = macro_find(name, h, 0);
 	if (i >= 0)
 		macros[i].undef = 1;
 }
 
-static int macro_new(char *name)
+static int macro_new(char *name, unsigned h)
 {
-	int i = macro_find(name, 1);
+	int i = macro_find(name, h, 1);
 	if (i >= 0)
 		return i;
-	if (mcount >= NDEFS)
-		die("nomem: NDEFS reached!\n");
+	if (mcount >= msize) {
+		int sz = MAX(256, msize * 2);
+		macros = mextend(macros, msize, sz, sizeof(macros[0]));
+		msize = sz;
+	}
 	i = mcount++;
-	strcpy(macros[i].name, name);
-	mnext[i] = mhead[(unsigned char) name[0]];
-	mhead[(unsigned char) name[0]] = i;
+	macros[i].name = macro_str(name, strlen(name));
+	htab_put(&mtab, h);
 	return i;
 }
 
 static void macro_define(void)
 {
 	char name[NAMELEN];
+	char args[NARGS][NAMELEN];
 	struct macro *d;
-	read_word(name);
-	d = &macros[macro_new(name)];
+	struct mem def;
+	int i, n = 0;
+	i = macro_new(name, read_word(name));	/* macros[] may move */
+	d = &macros[i];
 	d->isfunc = 0;
-	d->nargs = 0;
 	d->undef = 0;
 	if (buf[cur] == '(') {
 		cur++;
 		jumpws();
 		while (cur < len && buf[cur] != ')') {
-			readarg(d->args[d->nargs++]);
+			if (n >= NARGS)
+				die("nomem: NARGS reached!\n");
+			readarg(args[n++], sizeof(args[0]));
 			jumpws();
 			if (buf[cur] != ',')
 				break;
 			cur++;
 			jumpws();
 		}
+		if (cur >= len)
+			err("unterminated macro parameters\n");
 		cur++;
 		d->isfunc = 1;
 	}
-	read_tilleol(d->def);
+	d->args = n ? macro_alloc(n * sizeof(d->args[0])) : NULL;
+	for (i = 0; i < n; i++)
+		d->args[i] = macro_str(args[i], strlen(args[i]));
+	d->nargs = n;
+	mem_init(&def);
+	read_tilleol(&def);
+	d->def = macro_str(mem_buf(&def), mem_len(&def));
+	mem_done(&def);
 }
 
-static char ebuf[MARGLEN];
-static int elen;
+static struct mem ebuf;		/* the expanded expression of #if */
 static int ecur;
 
 static long evalexpr(void);
 
 static long cpp_eval(void)
 {
-	char evalbuf[MARGLEN];
+	struct mem evalbuf;
 	int old_limit;
 	long ret, clen;
 	char *cbuf;
-	read_tilleol(evalbuf);
-	buf_new(BUF_EVAL, evalbuf, strlen(evalbuf));
-	elen = 0;
+	mem_init(&evalbuf);
+	read_tilleol(&evalbuf);
+	buf_new(BUF_EVAL, mem_buf(&evalbuf), mem_len(&evalbuf));
+	mem_init(&ebuf);
 	ecur = 0;
 	old_limit = bufs_limit;
 	bufs_limit = bufs_n;
-	while (!cpp_read(&cbuf, &clen)) {
-		memcpy(ebuf + elen, cbuf, clen);
-		elen += clen;
-	}
+	while (!cpp_read(&cbuf, &clen))
+		mem_put(&ebuf, cbuf, clen);
 	bufs_limit = old_limit;
 	ret = evalexpr();
+	mem_done(&ebuf);
 	buf_pop();
+	mem_done(&evalbuf);
 	return ret;
 }
 
@@ -459,8 +961,8 @@ static int cpp_cmd(void)
 	}
 	if (!strcmp("undef", cmd)) {
 		char name[NAMELEN];
-		read_word(name);
-		macro_undef(name);
+		unsigned h = read_word(name);
+		macro_undef(name, h);
 		return 0;
 	}
 	if (!strcmp("ifdef", cmd) || !strcmp("ifndef", cmd) ||
@@ -469,9 +971,9 @@ static int cpp_cmd(void)
 		int matched = 0;
 		if (cmd[2]) {
 			int not = cmd[2] == 'n';
-			read_word(name);
-			matched = not ? macro_find(name, 0) < 0 :
-					macro_find(name, 0) >= 0;
+			unsigned h = read_word(name);
+			matched = not ? macro_find(name, h, 0) < 0 :
+					macro_find(name, h, 0) >= 0;
 		} else {
 			matched = cpp_eval();
 		}
@@ -485,12 +987,34 @@ static int cpp_cmd(void)
 	}
 	if (!strcmp("endif", cmd))
 		return 0;
+	if (!strcmp("pragma", cmd)) {
+		struct mem rest;
+		char name[NAMELEN];
+		int i = bufs_n - 1;
+		read_word(name);
+		while (i >= 0 && bufs[i].type != BUF_FILE)
+			i--;
+		if (!strcmp("once", name) && i >= 0 && bufs[i].inc >= 0)
+			incs[bufs[i].inc].once = 1;
+		/* other pragmas are ignored */
+		mem_init(&rest);
+		read_tilleol(&rest);
+		mem_done(&rest);
+		return 0;
+	}
 	if (!strcmp("include", cmd)) {
 		char file[NAMELEN];
 		char *s, *e;
+		int c;
 		jumpws();
+		c = buf[cur] == '<' ? '>' : '"';
+		if (cur >= len || (buf[cur] != '<' && buf[cur] != '"'))
+			err("malformed #include\n");
 		s = buf + cur + 1;
-		e = strchr(buf + cur + 1, buf[cur] == '"' ? '"' : '>');
+		for (e = s; e < buf + len && *e != c && *e != '\n'; e++)
+			;
+		if (e >= buf + len || *e != c || e - s >= NAMELEN)
+			err("malformed #include\n");
 		memcpy(file, s, e - s);
 		file[e - s] = '\0';
 		cur += e - s + 2;
@@ -516,7 +1040,7 @@ static int buf_arg_find(char *name)
 	int i;
 	for (i = bufs_n - 1; i >= 0; i--) {
 		struct buf *mbuf = &bufs[i];
-		struct macro *m = mbuf->macro;
+		struct macro *m = &macros[mbuf->macro];
 		if (mbuf->type == BUF_MACRO && macro_arg(m, name) >= 0)
 			return i;
 		if (mbuf->type == BUF_ARG)
@@ -525,17 +1049,17 @@ static int buf_arg_find(char *name)
 	return -1;
 }
 
-static void macro_expand(char *name)
+static void macro_expand(char *name, unsigned h)
 {
 	struct macro *m;
 	int mbuf;
 	if ((mbuf = buf_arg_find(name)) >= 0) {
-		int arg = macro_arg(bufs[mbuf].macro, name);
+		int arg = macro_arg(&macros[bufs[mbuf].macro], name);
 		char *dat = bufs[mbuf].args[arg];
 		buf_arg(dat, mbuf);
 		return;
 	}
-	m = &macros[macro_find(name, 0)];
+	m = &macros[macro_find(name, h, 0)];
 	if (!m->isfunc) {
 		buf_macro(m);
 		return;
@@ -547,13 +1071,17 @@ static void macro_expand(char *name)
 		cur++;
 		jumpws();
 		while (cur < len && buf[cur] != ')') {
-			readarg(mbuf->args[i++]);
+			if (i >= NARGS)
+				die("nomem: NARGS reached!\n");
+			readarg(mbuf->args[i++], sizeof(mbuf->args[0]));
 			jumpws();
 			if (buf[cur] != ',')
 				break;
 			cur++;
 			jumpws();
 		}
+		if (cur >= len)
+			err("unterminated macro arguments\n");
 		while (i < m->nargs)
 			mbuf->args[i++][0] = '\0';
 		cur++;
@@ -561,42 +1089,47 @@ static void macro_expand(char *name)
 	}
 }
 
-static int buf_expanding(char *macro)
+/* whether macros[idx] is being expanded */
+static int buf_expanding(int idx)
 {
 	int i;
 	for (i = bufs_n - 1; i >= 0; i--) {
 		if (bufs[i].type == BUF_ARG)
 			return 0;
-		if (bufs[i].type == BUF_MACRO &&
-				!strcmp(macro, bufs[i].macro->name))
+		if (bufs[i].type == BUF_MACRO && bufs[i].macro == idx)
 			return 1;
 	}
 	return 0;
 }
 
 /* return 1 for plain macros and arguments and 2 for function macros */
-static int expandable(char *word)
+static int expandable(char *word, unsigned h)
 {
 	int i;
 	if (buf_arg_find(word) >= 0)
 		return 1;
-	if (buf_expanding(word))
+	i = macro_find(word, h, 0);
+	if (i < 0 || buf_expanding(i))
 		return 0;
-	i = macro_find(word, 0);
-	return i >= 0 ? macros[i].isfunc + 1 : 0;
+	return macros[i].isfunc + 1;
 }
 
 void cpp_define(char *name, char *def)
 {
-	char tmp_buf[MDEFLEN];
-	sprintf(tmp_buf, "%s\t%s", name, def);
-	buf_new(BUF_TEMP, tmp_buf, strlen(tmp_buf));
+	struct mem tmp;
+	mem_init(&tmp);
+	mem_put(&tmp, name, strlen(name));
+	mem_putc(&tmp, '\t');
+	mem_put(&tmp, def, strlen(def));
+	buf_new(BUF_TEMP, mem_buf(&tmp), mem_len(&tmp));
 	macro_define();
 	buf_pop();
+	mem_done(&tmp);
 }
 
 static int seen_macro;		/* seen a macro; 2 if a function macro */
 static char seen_name[NAMELEN];	/* the name of the last macro */
+static unsigned seen_hash;	/* the hash of seen_name */
 
 static int hunk_off;
 static int hunk_len;
@@ -608,7 +1141,7 @@ int cpp_read(char **obuf, long *olen)
 	*olen = 0;
 	*obuf = "";
 	if (seen_macro == 1) {
-		macro_expand(seen_name);
+		macro_expand(seen_name, seen_hash);
 		seen_macro = 0;
 	}
 	if (cur == len) {
@@ -629,7 +1162,7 @@ int cpp_read(char **obuf, long *olen)
 			continue;
 		if (seen_macro == 2) {
 			if (buf[cur] == '(')
-				macro_expand(seen_name);
+				macro_expand(seen_name, seen_hash);
 			seen_macro = 0;
 			old = cur;
 			continue;
@@ -638,10 +1171,11 @@ int cpp_read(char **obuf, long *olen)
 			continue;
 		if (isalnum(buf[cur]) || buf[cur] == '_') {
 			char word[NAMELEN];
-			read_word(word);
-			seen_macro = expandable(word);
+			unsigned h = read_word(word);
+			seen_macro = expandable(word, h);
 			if (seen_macro) {
 				strcpy(seen_name, word);
+				seen_hash = h;
 				jump_name = 1;
 				break;
 			}
@@ -689,42 +1223,51 @@ static char *tok2[] = {
 
 static int eval_tok(void)
 {
+	char *e = mem_buf(&ebuf);
+	long n = mem_len(&ebuf);
 	char *s = etok;
 	int i;
-	while (ecur < elen) {
-		while (ecur < elen && isspace(ebuf[ecur]))
+	while (ecur < n) {
+		while (ecur < n && isspace(e[ecur]))
 			ecur++;
-		if (ebuf[ecur] == '/' && ebuf[ecur + 1] == '*') {
-			while (ecur < elen && (ebuf[ecur - 2] != '*' ||
-						ebuf[ecur - 1] != '/'))
+		if (e[ecur] == '/' && e[ecur + 1] == '*') {
+			ecur += 2;
+			while (ecur < n && (e[ecur] != '*' || e[ecur + 1] != '/'))
 				ecur++;
+			ecur = MIN(ecur + 2, n);
 			continue;
 		}
 		break;
 	}
-	if (ecur >= elen)
+	if (ecur >= n)
 		return TOK_EOF;
-	if (isalpha(ebuf[ecur]) || ebuf[ecur] == '_') {
-		while (isalnum(ebuf[ecur]) || ebuf[ecur] == '_')
-			*s++ = ebuf[ecur++];
+	if (isalpha(e[ecur]) || e[ecur] == '_') {
+		while (isalnum(e[ecur]) || e[ecur] == '_')
+			if (s < etok + NAMELEN - 1)
+				*s++ = e[ecur++];
+			else
+				ecur++;
 		*s = '\0';
 		return TOK_NAME;
 	}
-	if (isdigit(ebuf[ecur])) {
-		while (isdigit(ebuf[ecur]))
-			*s++ = ebuf[ecur++];
-		while (tolower(ebuf[ecur]) == 'u' || tolower(ebuf[ecur]) == 'l')
+	if (isdigit(e[ecur])) {
+		while (isdigit(e[ecur]))
+			if (s < etok + NAMELEN - 1)
+				*s++ = e[ecur++];
+			else
+				ecur++;
+		while (tolower(e[ecur]) == 'u' || tolower(e[ecur]) == 'l')
 			ecur++;
 		*s = '\0';
 		return TOK_NUM;
 	}
 	for (i = 0; i < LEN(tok2); i++)
-		if (TOK2(tok2[i]) == TOK2(ebuf + ecur)) {
+		if (TOK2(tok2[i]) == TOK2(e + ecur)) {
 			int ret = TOK2(tok2[i]);
 			ecur += 2;
 			return ret;
 		}
-	return ebuf[ecur++];
+	return e[ecur++];
 }
 
 static int eval_see(void)
@@ -778,7 +1321,7 @@ static long evalatom(void)
 		int parens = !eval_jmp('(');
 		long ret;
 		eval_expect(TOK_NAME);
-		ret = macro_find(eval_id(), 0) >= 0;
+		ret = macro_find(eval_id(), hash(eval_id()), 0) >= 0;
 		if (parens)
 			eval_expect(')');
 		return ret;
@@ -946,8 +1489,10 @@ static long evalcexpr(void)
 		return ret;
 	if (ret)
 		return evalor();
-	while (eval_get() != ':')
-		;
+	while (eval_see() != ':' && eval_see() != TOK_EOF)
+		eval_get();
+	if (eval_get() != ':')
+		err("expected ':' in #if\n");
 	return evalor();
 }
 
@@ -973,13 +1518,67 @@ char *cpp_loc(long addr)
 	static char loc[256];
 	int line = -1;
 	int i;
+	if (!bufs_n) {		/* the whole input is consumed */
+		sprintf(loc, "%s:eof", bufs[0].path);
+		return loc;
+	}
 	for (i = bufs_n - 1; i > 0; i--)
 		if (bufs[i].type == BUF_FILE)
 			break;
 	if (addr >= hunk_off && i == bufs_n - 1)
 		line = buf_loc(buf, (cur - hunk_len) + (addr - hunk_off));
+	else if (i == bufs_n - 1)	/* bufs[i].buf is set in buf_new() */
+		line = buf_loc(buf, cur);
 	else
 		line = buf_loc(bufs[i].buf, bufs[i].cur);
 	sprintf(loc, "%s:%d", bufs[i].path, line);
 	return loc;
 }
+
+/* release the state of the preprocessor; the file cache is kept */
+void cpp_done(void)
+{
+	int i;
+	while (bufs_n)
+		buf_pop();
+	buf = NULL;
+	len = 0;
+	cur = 0;
+	bufs_limit = 0;
+	for (i = 0; i < mpool_n; i++)
+		free(mpool[i]);
+	free(mpool);
+	free(macros);
+	mpool = NULL;
+	mpool_n = 0;
+	mpool_sz = 0;
+	mpool_cur = NULL;
+	mpool_left = 0;
+	macros = NULL;
+	msize = 0;
+	mcount = 0;
+	htab_done(&mtab);
+	nlocs = 0;
+	mem_done(&ebuf);
+	ecur = 0;
+	enext = 0;
+	seen_macro = 0;
+	hunk_off = 0;
+	hunk_len = 0;
+	for (i = 0; i < incs_n; i++)
+		free(incs[i].guard);
+	free(incs);
+	incs = NULL;
+	incs_n = 0;
+	incs_sz = 0;
+	htab_done(&incs_tab);
+	for (i = 0; i < ipaths_n; i++)
+		free(ipaths[i].name);
+	free(ipaths);
+	ipaths = NULL;
+	ipaths_n = 0;
+	ipaths_sz = 0;
+	htab_done(&ipaths_tab);
+	memset(locs_stat, 0, sizeof(locs_stat));
+	fc_cwd[0] = '\0';
+}
@@ -2,10 +2,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #include "ncc.h"
 
+#define CG_BATCH	(1 << 14)	/* instructions sent to each worker */
+#define CS_CHUNK	(1 << 16)	/* the code written to the object at once */
+
 static struct mem ds;		/* data segment */
 static struct mem cs;		/* code segment */
+static struct mem rs;		/* read-only string section */
+static long cs_out;		/* the length of the code written to cs_fd */
+static int cs_fd = -1;		/* the object file, if the code is streamed */
+static int cs_err;		/* writing to cs_fd failed */
 static long bsslen;		/* bss segment size */
 static struct ic *ic;		/* current instruction stream */
 static long ic_n;		/* number of instructions in ic[] */
@@ -20,7 +29,47 @@ static int *loc_mem;		/* local was accessed on the stack */
 static char (*ds_name)[NAMELEN];/* data section symbols */
 static long *ds_off;		/* data section offsets */
 static long ds_n, ds_sz;	/* number of data section symbols */
+static struct htab ds_tab;	/* ds_name[] hash table */
+
+static long *rs_off;		/* the offset of interned strings in rs */
+static long rs_n, rs_sz;	/* number of interned strings */
+static struct htab rs_tab;	/* rs_off[] hash table */
+
+static long *jtab_off;		/* data section offset of jump tables */
+static long *jtab_sym;		/* the symbol of jump tables */
+static long jtab_n, jtab_sz;	/* number of jump tables */
+
+/* a function waiting for code generation */
+struct func {
+	char name[NAMELEN];	/* function name */
+	long flags;		/* function symbol flags */
+	long sym;		/* function symbol */
+	int argc, varg;		/* number of arguments and varargs */
+	struct ic *ic;		/* intermediate code */
+	long ic_n;		/* number of instructions in ic[] */
+	long *loc_off;		/* offset of locals */
+	long loc_n, loc_pos;	/* number of locals and stack position */
+};
+
+/* a code generation worker process */
+struct cgw {
+	int pid;		/* process id */
+	int fd;			/* the pipe for reading the output */
+	struct func *f;		/* functions assigned to this worker */
+	long f_n;		/* number of entries in f[] */
+};
 
+static struct func *cg_func;	/* functions not sent to workers */
+static long cg_n, cg_sz;	/* number of entries in cg_func[] */
+static long cg_ics;		/* instructions in cg_func[] */
+static struct cgw *cg_w;	/* running workers, in source order */
+static int cg_beg, cg_cnt;	/* the first and the number of workers */
+static int cg_max;		/* maximum number of workers */
+static long cg_hits, cg_miss;	/* function code cache statistics */
+
+static char func_name[NAMELEN];	/* the name of the current function */
+static long func_flags;		/* the symbol flags of the current function */
+static long func_sym;		/* the symbol of the current function */
 static int func_argc;		/* number of arguments */
 static int func_varg;		/* varargs */
 static int func_regs;		/* used registers */
@@ -31,6 +80,7 @@ static long ra_vmap[N_REGS];	/* register to intermediate value assignments */
 static long ra_lmap[N_REGS];	/* register to local assignments */
 static long *ra_gmask;		/* the mask of good registers for each value */
 static long ra_live[NTMPS];	/* live values */
+static long *ra_pin;		/* the register of values kept across basic blocks */
 static int ra_vmax;		/* the number of values stored on the stack */
 
 static long loc_add(long pos)
@@ -58,12 +108,47 @@ long o_arg2loc(int i)
 	return i;
 }
 
+/* write the code to the object file fd as it is generated; see o_write() */
+void o_stream(int fd)
+{
+	cs_fd = lseek(fd, 0, SEEK_CUR) < 0 ? -1 : fd;
+}
+
+/* the offset of the next function in the code segment */
+static long cs_pos(void)
+{
+	return cs_out + mem_len(&cs);
+}
+
+/* write the code generated so far, if streamed and large enough */
+static void cs_flush(void)
+{
+	if (cs_fd < 0 || cs_err || mem_len(&cs) < CS_CHUNK)
+		return;
+	prof_beg(PR_OUT);
+	cs_err = out_code(cs_fd, mem_buf(&cs), mem_len(&cs));
+	cs_out += mem_len(&cs);
+	mem_cut(&cs, 0);
+	prof_end();
+}
+
 void o_bsnew(char *name, long size, int global)
 {
 	out_def(name, OUT_BSS | (global ? OUT_GLOB : 0), bsslen, size);
 	bsslen += ALIGN(size, OUT_ALIGNMENT);
 }
 
+/* the index of name in ds_name[]; the first of equal names is found */
+static long ds_find(char *name)
+{
+	long i, found = -1;
+	for (i = htab_get(&ds_tab, hash(name)); i >= 0;
+			i = htab_next(&ds_tab, i))
+		if (!strcmp(name, ds_name[i]))
+			found = i;
+	return found;
+}
+
 long o_dsnew(char *name, long size, int global)
 {
 	int idx;
@@ -75,11 +160,36 @@ long o_dsnew(char *name, long size, int global)
 	idx = ds_n++;
 	strcpy(ds_name[idx], name);
 	ds_off[idx] = mem_len(&ds);
+	htab_put(&ds_tab, hash(name));
 	out_def(name, OUT_DS | (global ? OUT_GLOB : 0), mem_len(&ds), size);
 	mem_putz(&ds, ALIGN(size, OUT_ALIGNMENT));
 	return ds_off[idx];
 }
 
+/*
+ * Intern the null-terminated string s in the read-only string section
+ * and return its offset from OUT_RSSYM.  The section is mergeable;
+ * the linker may share strings of different objects.
+ */
+long o_rsnew(char *s)
+{
+	unsigned h = hash(s);
+	long i;
+	for (i = htab_get(&rs_tab, h); i >= 0; i = htab_next(&rs_tab, i))
+		if (!strcmp((char *) mem_buf(&rs) + rs_off[i], s))
+			return rs_off[i];
+	if (rs_n >= rs_sz) {
+		rs_sz = MAX(128, rs_sz * 2);
+		rs_off = mextend(rs_off, rs_n, rs_sz, sizeof(rs_off[0]));
+	}
+	if (!mem_len(&rs))
+		out_def(OUT_RSSYM, OUT_RS, 0, 0);
+	rs_off[rs_n] = mem_len(&rs);
+	mem_put(&rs, s, strlen(s) + 1);
+	htab_put(&rs_tab, h);
+	return rs_off[rs_n++];
+}
+
 void o_dscpy(long addr, void *buf, long len)
 {
 	mem_cpy(&ds, addr, buf, len);
@@ -87,11 +197,8 @@ void o_dscpy(long addr, void *buf, long len)
 
 static int dat_off(char *name)
 {
-	int i;
-	for (i = 0; i < ds_n; i++)
-		if (!strcmp(name, ds_name[i]))
-			return ds_off[i];
-	return 0;
+	long i = ds_find(name);
+	return i >= 0 ? ds_off[i] : 0;
 }
 
 void o_dsset(char *name, long off, long bt)
@@ -108,6 +215,29 @@ void o_dsset(char *name, long off, long bt)
 	}
 }
 
+/*
+ * Allocate a jump table of n entries in the data section for the
+ * current function and return its identifier.  The entries are
+ * relative to the function symbol and are filled once the position
+ * of labels is known.
+ */
+long o_jtabnew(long n)
+{
+	char name[NAMELEN];
+	long i;
+	if (jtab_n >= jtab_sz) {
+		jtab_sz = MAX(16, jtab_sz * 2);
+		jtab_off = mextend(jtab_off, jtab_n, jtab_sz, sizeof(jtab_off[0]));
+		jtab_sym = mextend(jtab_sym, jtab_n, jtab_sz, sizeof(jtab_sym[0]));
+	}
+	sprintf(name, "__neatcc.j%ld", jtab_n);
+	jtab_off[jtab_n] = o_dsnew(name, n * ULNG, 0);
+	jtab_sym[jtab_n] = out_sym(name);
+	for (i = 0; i < n; i++)
+		out_rel(func_sym, OUT_DS, jtab_off[jtab_n] + i * ULNG);
+	return jtab_n++;
+}
+
 static int ra_vreg(int val)
 {
 	int i;
@@ -225,10 +355,14 @@ static void ra_map(int *rd, int *r1, int *r2, int *r3, long *mt)
 	 * the registers used in global register allocation should not
 	 * be used in the last instruction of a basic block.
 	 */
-	if (c->op & (O_JZ | O_JCC))
+	if (c->op & (O_JZ | O_JCC | O_JTAB)) {
 		for (i = 0; i < LEN(ra_lmap); i++)
 			if (reg_rmap(ic_i, i) >= 0 && ra_lmap[i] != reg_rmap(ic_i, i))
 				all |= (1 << i);
+		for (i = 0; i < LEN(ra_live); i++)
+			if (ra_live[i] >= 0 && ra_pin[ra_live[i]] >= 0)
+				all |= (1 << ra_pin[ra_live[i]]);
+	}
 	/* allocating registers for the operands */
 	if (n >= 2) {
 		*r2 = ra_regget(c->a2, m2, m2, all);
@@ -249,9 +383,9 @@ static void ra_map(int *rd, int *r1, int *r2, int *r3, long *mt)
 			*rd = *r1;
 		else if (ra_gmask[ic_i] & md & ~all)
 			*rd = ra_regget(ic_i, ra_gmask[ic_i], md, 0);
-		else if (n >= 2 && md & (1 << *r2) && ic_luse[*r2] <= ic_i)
+		else if (n >= 2 && md & (1 << *r2) && ic_luse[c->a2] <= ic_i)
 			*rd = *r2;
-		else if (n >= 1 && md & (1 << *r1) && ic_luse[*r1] <= ic_i)
+		else if (n >= 1 && md & (1 << *r1) && ic_luse[c->a1] <= ic_i)
 			*rd = *r1;
 		else
 			*rd = ra_regget(ic_i, ra_gmask[ic_i], md, 0);
@@ -442,13 +576,40 @@ static void ra_lsave(long loc, long off, int reg, int bt)
 	}
 }
 
+/* return nonzero if value iv can stay in register reg till its last use */
+static int ra_pinok(long iv, int reg)
+{
+	long i;
+	for (i = iv; i <= ic_luse[iv]; i++)
+		if (reg_rmap(i, reg) >= 0)
+			return 0;
+	return 1;
+}
+
 /* end of a basic block */
 static void ra_bbend(void)
 {
+	long pinned = 0;
+	long iv;
 	int i;
+	/* deciding the register of values kept across basic blocks */
+	for (i = 0; i < LEN(ra_live); i++)
+		if (ra_live[i] >= 0 && ra_pin[ra_live[i]] >= 0)
+			pinned |= 1 << ra_pin[ra_live[i]];
+	for (i = 0; i < LEN(ra_live); i++) {
+		iv = ra_live[i];
+		if (iv >= 0 && ra_pin[iv] == -2) {
+			int reg = ra_vreg(iv);
+			if (reg >= 0 && !(pinned & (1 << reg)) && ra_pinok(iv, reg))
+				pinned |= 1 << reg;
+			else
+				reg = -1;
+			ra_pin[iv] = reg;
+		}
+	}
 	/* save values to memory */
 	for (i = 0; i < LEN(ra_vmap); i++)
-		if (ra_vmap[i] >= 0)
+		if (ra_vmap[i] >= 0 && ra_pin[ra_vmap[i]] != i)
 			ra_spill(i);
 	/* dropping local caches */
 	for (i = 0; i < LEN(ra_lmap); i++)
@@ -461,6 +622,93 @@ static void ra_bbend(void)
 			loc_toreg(ra_lmap[i], 0, i, ULNG);
 		}
 	}
+	/* load values kept in registers across basic blocks */
+	for (i = 0; i < LEN(ra_live); i++) {
+		iv = ra_live[i];
+		if (iv >= 0 && ra_pin[iv] >= 0 && ra_vreg(iv) < 0) {
+			val_toreg(iv, ra_pin[iv]);
+			ra_vmap[ra_pin[iv]] = iv;
+		}
+	}
+}
+
+/* record a jump between points a and b in lo[] and hi[] */
+static void ra_edge(long *lo, long *hi, long a, long b)
+{
+	lo[a] = MIN(lo[a], b);
+	hi[a] = MAX(hi[a], b);
+	lo[b] = MIN(lo[b], a);
+	hi[b] = MAX(hi[b], a);
+}
+
+/*
+ * Find the values that may stay in registers across basic blocks.
+ * Registers are not reconciled along jumps, so only the values whose
+ * live range crosses a basic block boundary, while no jump leaves the
+ * range and no jump enters it from outside, are kept; the others are
+ * spilled at basic block boundaries.  The register of these values is
+ * decided at the first basic block boundary (ra_pin[] is -2 until then).
+ *
+ * The jump of ic[j] starts at point 2j+1 and its target t is point 2t;
+ * the range of the value of ic[i] that is last used in ic[e] covers
+ * points 2i+2 to 2e.  No jump crosses its boundary if the first point
+ * from 2i+2 with a jump to before 2i+2 (fst[2i+2]) and the last point
+ * up to 2e with a jump to after 2e (lst[2e]) are outside the range.
+ */
+static void ra_pininit(struct ic *ic, long ic_n)
+{
+	long n = 2 * ic_n + 1;
+	long *lo = malloc(n * sizeof(lo[0]));	/* the farthest jump back */
+	long *hi = malloc(n * sizeof(hi[0]));	/* the farthest jump ahead */
+	long *fst = malloc(n * sizeof(fst[0]));
+	long *lst = malloc(n * sizeof(lst[0]));
+	long *stk = malloc(n * sizeof(stk[0]));
+	long *nbb = calloc(ic_n + 1, sizeof(nbb[0]));
+	long i, j, sn = 0;
+	for (i = 0; i < n; i++) {
+		lo[i] = i;
+		hi[i] = i;
+	}
+	for (i = 0; i < ic_n; i++) {
+		ra_pin[i] = -1;
+		nbb[i + 1] = nbb[i] + ic_bbeg[i];
+		if (ic[i].op & O_JXX)
+			ra_edge(lo, hi, 2 * i + 1, 2 * ic[i].a3);
+		for (j = 0; ic[i].op & O_JTAB && j < ic[i].a2; j++)
+			ra_edge(lo, hi, 2 * i + 1, 2 * ic[i].args[j]);
+	}
+	/* stk[] keeps the candidates with lo[] decreasing from the top */
+	for (i = n - 1; i >= 0; i--) {
+		while (sn && lo[stk[sn - 1]] >= lo[i])
+			sn--;
+		stk[sn++] = i;
+		while (sn && lo[stk[sn - 1]] >= i)
+			sn--;
+		fst[i] = sn ? stk[sn - 1] : n;
+	}
+	sn = 0;
+	for (i = 0; i < n; i++) {
+		while (sn && hi[stk[sn - 1]] <= hi[i])
+			sn--;
+		stk[sn++] = i;
+		while (sn && hi[stk[sn - 1]] <= i)
+			sn--;
+		lst[i] = sn ? stk[sn - 1] : -1;
+	}
+	for (i = 0; i < ic_n && opt(2); i++) {
+		long e = ic_luse[i];
+		if (!(ic[i].op & O_OUT) || e <= i + 1)
+			continue;
+		if (nbb[e + 1] > nbb[i + 1] && fst[2 * i + 2] > 2 * e &&
+				lst[2 * e] < 2 * i + 2)
+			ra_pin[i] = -2;
+	}
+	free(lo);
+	free(hi);
+	free(fst);
+	free(lst);
+	free(stk);
+	free(nbb);
 }
 
 static void ra_init(struct ic *ic, long ic_n)
@@ -469,14 +717,21 @@ static void ra_init(struct ic *ic, long ic_n)
 	int i, j;
 	ic_bbeg = calloc(ic_n, sizeof(ic_bbeg[0]));
 	ra_gmask = calloc(ic_n, sizeof(ra_gmask[0]));
+	ra_pin = malloc(ic_n * sizeof(ra_pin[0]));
 	loc_mem = calloc(loc_n, sizeof(loc_mem[0]));
 	/* ic_bbeg */
 	for (i = 0; i < ic_n; i++) {
-		if (i + 1 < ic_n && ic[i].op & (O_JXX | O_RET))
+		if (i + 1 < ic_n && ic[i].op & (O_JXX | O_JTAB | O_RET))
 			ic_bbeg[i + 1] = 1;
 		if (ic[i].op & O_JXX && ic[i].a3 < ic_n)
 			ic_bbeg[ic[i].a3] = 1;
+		if (ic[i].op & O_JTAB)
+			for (j = 0; j < ic[i].a2; j++)
+				if (ic[i].args[j] < ic_n)
+					ic_bbeg[ic[i].args[j]] = 1;
 	}
+	/* ra_pin */
+	ra_pininit(ic, ic_n);
 	/* ra_gmask */
 	for (i = 0; i < ic_n; i++) {
 		int n = ic_regcnt(ic + i);
@@ -512,6 +767,7 @@ static void ra_done(void)
 {
 	free(ic_bbeg);
 	free(ra_gmask);
+	free(ra_pin);
 	free(loc_mem);
 }
 
@@ -573,7 +829,7 @@ static void ic_gencode(struct ic *ic, long ic_n)
 					ra_vmap[rd] >= 0)
 				ra_spill(rd);
 		/* before the last instruction of a basic block; for jumps */
-		if (i + 1 < ic_n && ic_bbeg[i + 1] && oc & O_JXX)
+		if (i + 1 < ic_n && ic_bbeg[i + 1] && oc & (O_JXX | O_JTAB))
 			ra_bbend();
 		/* performing the instruction */
 		if (oc & O_BOP)
@@ -608,6 +864,8 @@ static void ic_gencode(struct ic *ic, long ic_n)
 			i_ins(op, 0, r1, 0, ic[i].a3);
 		if (oc & O_JCC)
 			i_ins(op, 0, r1, oc & O_NUM ? ic[i].a2 : r2, ic[i].a3);
+		if (oc == O_JTAB)
+			i_ins(op, 0, r1, jtab_sym[ic[i].a3], 0);
 		if (oc == O_MSET)
 			i_ins(op, 0, r1, r2, r3);
 		if (oc == O_MCPY)
@@ -616,7 +874,7 @@ static void ic_gencode(struct ic *ic, long ic_n)
 		if (oc & O_OUT && ic_luse[i] > i)
 			ra_vsave(ic_i, rd);
 		/* after the last instruction of a basic block */
-		if (i + 1 < ic_n && ic_bbeg[i + 1] && !(oc & O_JXX))
+		if (i + 1 < ic_n && ic_bbeg[i + 1] && !(oc & (O_JXX | O_JTAB)))
 			ra_bbend();
 	}
 	i_label(ic_n);
@@ -636,22 +894,229 @@ static void ic_reset(void)
 void o_func_beg(char *name, int argc, int global, int varg)
 {
 	int i;
+	strcpy(func_name, name);
+	func_flags = (global ? OUT_GLOB : 0) | OUT_CS;
 	func_argc = argc;
 	func_varg = varg;
-	func_regs = 0;
 	ic_reset();
 	for (i = 0; i < argc; i++)
 		loc_add(I_ARG0 + -i * ULNG);
-	out_def(name, (global ? OUT_GLOB : 0) | OUT_CS, mem_len(&cs), 0);
+	out_def(name, func_flags, cs_pos(), 0);
+	func_sym = out_sym(name);
+	prof_span(name);
 }
 
 void o_code(char *name, char *c, long c_len)
 {
-	out_def(name, OUT_CS, mem_len(&cs), 0);
+	out_def(name, OUT_CS, cs_pos(), 0);
 	mem_put(&cs, c, c_len);
+	cs_flush();
 }
 
-void o_func_end(void)
+static void out_long(struct mem *mem, long n)
+{
+	mem_put(mem, &n, sizeof(n));
+}
+
+static long in_long(char **s)
+{
+	long n;
+	memcpy(&n, *s, sizeof(n));
+	*s += sizeof(n);
+	return n;
+}
+
+static void func_free(struct func *f)
+{
+	long i;
+	for (i = 0; i < f->ic_n; i++)
+		ic_free(&f->ic[i]);
+	free(f->ic);
+	free(f->loc_off);
+	f->ic = NULL;
+	f->ic_n = 0;
+	f->loc_off = NULL;
+}
+
+/*
+ * The code of functions is cached by the digest of their intermediate
+ * code, in which symbols are replaced with their index in the list of
+ * symbols the function refers to (refs) and their names.  The names
+ * of compiler-generated symbols are omitted, since they depend on the
+ * position of the function in the file.  Cache entries contain the
+ * output of func_gen() with the same symbol indices, except jump
+ * table offsets: they contain the length and the contents of the
+ * code, its relocations, and the label offsets of jump tables.
+ */
+
+/* return the index of sym in refs, adding it if missing */
+static long func_ref(struct mem *refs, long sym)
+{
+	long *r = mem_buf(refs);
+	long n = mem_len(refs) / sizeof(r[0]);
+	long i;
+	for (i = 0; i < n; i++)
+		if (r[i] == sym)
+			return i;
+	out_long(refs, sym);
+	return n;
+}
+
+/* the code cache key of function f; return nonzero if not cached */
+static int func_key(struct func *f, struct mem *refs, char *key)
+{
+	struct mem k;
+	long *r;
+	long i, j;
+	int ret = 0;
+	mem_init(&k);
+	out_long(&k, f->argc);
+	out_long(&k, f->varg);
+	out_long(&k, f->loc_pos);
+	out_long(&k, f->loc_n);
+	mem_put(&k, f->loc_off, f->loc_n * sizeof(f->loc_off[0]));
+	for (i = 0; i < f->ic_n; i++) {
+		struct ic *c = &f->ic[i];
+		long a1 = c->a1, a3 = c->a3;
+		long n = 0;
+		if (c->op & O_SYM && !(c->op & (O_MOV | O_CALL)))
+			ret = 1;
+		if (c->op & O_SYM)
+			a1 = func_ref(refs, c->a1);
+		if (c->op & O_JTAB)
+			a3 = func_ref(refs, jtab_sym[c->a3]);
+		out_long(&k, c->op);
+		out_long(&k, a1);
+		out_long(&k, c->a2);
+		out_long(&k, a3);
+		if (c->op & O_CALL)
+			n = c->a3;
+		if (c->op & O_JTAB)
+			n = c->a2;
+		for (j = 0; j < n; j++)
+			out_long(&k, c->args[j]);
+	}
+	r = mem_buf(refs);
+	for (i = 0; i < mem_len(refs) / sizeof(r[0]); i++) {
+		char *name = out_name(r[i]);
+		if (!strncmp(name, "__neatcc.", 9))
+			name = "";
+		mem_put(&k, name, strlen(name) + 1);
+	}
+	if (!ret)
+		ret = cache_hash("func", mem_buf(&k), mem_len(&k), key);
+	mem_done(&k);
+	return ret;
+}
+
+/* append the output of func_gen() for f from the cache; nonzero if missing */
+static int func_load(struct func *f, struct mem *refs, char *key, struct mem *out)
+{
+	struct mem ent;
+	long *r = mem_buf(refs);
+	long nrefs = mem_len(refs) / sizeof(r[0]);
+	long c_len, rcnt, njtab = 0;
+	char *s, *e;
+	long i, j;
+	mem_init(&ent);
+	if (cache_load(key, &ent)) {
+		mem_done(&ent);
+		return 1;
+	}
+	for (i = 0; i < f->ic_n; i++)
+		if (f->ic[i].op & O_JTAB)
+			njtab += f->ic[i].a2;
+	s = mem_buf(&ent);
+	e = s + mem_len(&ent);
+	/* checking the entry */
+	if (e - s < 2 * sizeof(long) || (c_len = in_long(&s)) < 0 ||
+			e - s < c_len + sizeof(long))
+		c_len = -1;
+	if (c_len >= 0) {
+		s += c_len;
+		rcnt = in_long(&s);
+		if (rcnt < 0 || e - s != (rcnt * 3 + njtab) * sizeof(long))
+			c_len = -1;
+		for (i = 0; c_len >= 0 && i < rcnt; i++)
+			if ((unsigned long) in_long(&s) >= nrefs ||
+					((s += 2 * sizeof(long)), 0))
+				c_len = -1;
+	}
+	if (c_len < 0) {
+		mem_done(&ent);
+		return 1;
+	}
+	s = mem_buf(&ent);
+	out_long(out, 1);		/* a cache hit */
+	out_long(out, in_long(&s));
+	mem_put(out, s, c_len);
+	s += c_len;
+	rcnt = in_long(&s);
+	out_long(out, rcnt);
+	for (i = 0; i < rcnt; i++) {
+		out_long(out, r[in_long(&s)]);
+		out_long(out, in_long(&s));
+		out_long(out, in_long(&s));
+	}
+	for (i = 0; i < f->ic_n; i++)
+		for (j = 0; f->ic[i].op & O_JTAB && j < f->ic[i].a2; j++) {
+			out_long(out, jtab_off[f->ic[i].a3] + j * ULNG);
+			out_long(out, in_long(&s));
+		}
+	out_long(out, -1);
+	mem_done(&ent);
+	return 0;
+}
+
+/* insert the code of f into the cache */
+static void func_store(struct func *f, struct mem *refs, char *key,
+		char *c, long c_len, long *rsym, long *rflg, long *roff, long rcnt)
+{
+	struct mem ent;
+	long i, j;
+	mem_init(&ent);
+	out_long(&ent, c_len);
+	mem_put(&ent, c, c_len);
+	out_long(&ent, rcnt);
+	for (i = 0; i < rcnt; i++) {
+		long *r = mem_buf(refs);
+		long n = mem_len(refs) / sizeof(r[0]);
+		long idx = func_ref(refs, rsym[i]);
+		if (idx >= n) {		/* a symbol missing in the code */
+			mem_done(&ent);
+			return;
+		}
+		out_long(&ent, idx);
+		out_long(&ent, rflg[i]);
+		out_long(&ent, roff[i]);
+	}
+	for (i = 0; i < f->ic_n; i++)
+		for (j = 0; f->ic[i].op & O_JTAB && j < f->ic[i].a2; j++)
+			out_long(&ent, i_labpos(f->ic[i].args[j]));
+	cache_put(key, mem_buf(&ent), mem_len(&ent));
+	mem_done(&ent);
+}
+
+/* append the timing of func_gen() to out */
+static void func_prof(struct mem *out, long *t)
+{
+	int i;
+	if (!prof_enabled())
+		return;
+	out_long(out, getpid());
+	for (i = 0; i < 5; i++)
+		out_long(out, t[i]);
+}
+
+/*
+ * Generate the code of function f and append it to out: whether it was
+ * found in the code cache (1), missed (0) or is not cached (-1), the
+ * length and the contents of its code, its relocations, the contents
+ * of its jump table entries and, if enabled, its timing (prof_func()).
+ * Function code is position-independent, so it may be generated in a
+ * worker process and added to cs by func_put().
+ */
+static void func_gen(struct func *f, struct mem *out)
 {
 	long spsub;
 	long sargs = 0;
@@ -661,11 +1126,35 @@ void o_func_end(void)
 	long c_len, *rsym, *rflg, *roff, rcnt;
 	int leaf = 1;
 	int locs = 0;			/* accessing locals on the stack */
-	int i;
-	ic_get(&ic, &ic_n);		/* the intermediate code */
+	struct mem refs;		/* symbols referenced by f */
+	char key[64];
+	int cached;
+	long t[5];
+	int i, j;
+	t[0] = prof_now();
+	mem_init(&refs);
+	cached = !func_key(f, &refs, key);
+	if (cached && !func_load(f, &refs, key, out)) {
+		t[1] = t[2] = t[3] = t[4] = prof_now();
+		func_prof(out, t);
+		mem_done(&refs);
+		func_free(f);
+		return;
+	}
+	ic = f->ic;
+	ic_n = f->ic_n;
+	loc_off = f->loc_off;
+	loc_n = f->loc_n;
+	loc_pos = f->loc_pos;
+	func_argc = f->argc;
+	func_varg = f->varg;
+	func_sym = f->sym;
+	func_regs = 0;
+	t[1] = prof_now();
 	reg_init(ic, ic_n);		/* global register allocation */
-	ra_init(ic, ic_n);		/* initialize register allocation */
+	t[2] = prof_now();
 	ic_luse = ic_lastuse(ic, ic_n);
+	ra_init(ic, ic_n);		/* initialize register allocation */
 	ic_gencode(ic, ic_n);		/* generating machine code */
 	free(ic_luse);
 	/* deciding which arguments to save */
@@ -689,31 +1178,286 @@ void o_func_end(void)
 		if (ic[i].op & O_CALL)
 			leaf = 0;
 	/* adding function prologue and epilogue */
+	t[3] = prof_now();
 	i_wrap(func_argc, sargs, spsub, spsub || locs || !leaf,
 		func_regs & R_PERM, -sregs_pos);
 	ra_done();
 	i_code(&c, &c_len, &rsym, &rflg, &roff, &rcnt);
-	for (i = 0; i < rcnt; i++)	/* adding the relocations */
-		out_rel(rsym[i], rflg[i], roff[i] + mem_len(&cs));
-	mem_put(&cs, c, c_len);		/* appending function code */
+	t[4] = prof_now();
+	out_long(out, cached ? 0 : -1);
+	out_long(out, c_len);		/* function code */
+	mem_put(out, c, c_len);
+	out_long(out, rcnt);		/* the relocations */
+	for (i = 0; i < rcnt; i++) {
+		out_long(out, rsym[i]);
+		out_long(out, rflg[i]);
+		out_long(out, roff[i]);
+	}
+	for (i = 0; i < ic_n; i++)	/* jump table entries */
+		for (j = 0; ic[i].op & O_JTAB && j < ic[i].a2; j++) {
+			out_long(out, jtab_off[ic[i].a3] + j * ULNG);
+			out_long(out, i_labpos(ic[i].args[j]));
+		}
+	out_long(out, -1);
+	func_prof(out, t);
+	if (cached)
+		func_store(f, &refs, key, c, c_len, rsym, rflg, roff, rcnt);
+	mem_done(&refs);
 	free(c);
 	free(rsym);
 	free(rflg);
 	free(roff);
-	for (i = 0; i < ic_n; i++)
-		ic_free(&ic[i]);
-	free(ic);
 	reg_done();
+	func_free(f);
+	ic = NULL;
+	loc_off = NULL;
+	loc_n = 0;
+}
+
+/* append the output of func_gen() for function f to the code segment */
+static void func_put(struct func *f, char **s)
+{
+	long pos = cs_pos();
+	long hit = in_long(s);
+	long c_len = in_long(s);
+	long rcnt, off, i;
+	if (hit > 0)
+		cg_hits++;
+	if (hit == 0)
+		cg_miss++;
+	out_def(f->name, f->flags, pos, 0);
+	mem_put(&cs, *s, c_len);
+	*s += c_len;
+	rcnt = in_long(s);
+	for (i = 0; i < rcnt; i++) {
+		long sym = in_long(s);
+		long flg = in_long(s);
+		out_rel(sym, flg, in_long(s) + pos);
+	}
+	while ((off = in_long(s)) >= 0) {
+		long lab = in_long(s);
+		mem_cpy(&ds, off, &lab, ULNG);
+	}
+	if (prof_enabled()) {
+		long tid = in_long(s);
+		long t[5];
+		for (i = 0; i < 5; i++)
+			t[i] = in_long(s);
+		prof_func(f->name, tid, t);
+	}
+	cs_flush();
+}
+
+/* wait for the oldest worker and add its functions to cs */
+static void cg_wait(void)
+{
+	struct cgw *w = &cg_w[cg_beg];
+	struct mem out;
+	char buf[1 << 12];
+	char *s;
+	long i, n;
+	int status;
+	mem_init(&out);
+	while ((n = read(w->fd, buf, sizeof(buf))) > 0)
+		mem_put(&out, buf, n);
+	close(w->fd);
+	if (waitpid(w->pid, &status, 0) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status))
+		die("neatcc: code generation worker failed\n");
+	s = mem_buf(&out);
+	for (i = 0; i < w->f_n; i++)
+		func_put(&w->f[i], &s);
+	free(w->f);
+	mem_done(&out);
+	cg_beg = (cg_beg + 1) % cg_max;
+	cg_cnt--;
+}
+
+/* start a worker to generate the code of the functions in cg_func[] */
+static void cg_fork(void)
+{
+	struct cgw *w;
+	int fds[2];
+	long i;
+	if (cg_cnt == cg_max)
+		cg_wait();
+	w = &cg_w[(cg_beg + cg_cnt) % cg_max];
+	if (pipe(fds) || (w->pid = fork()) < 0)
+		die("neatcc: cannot start a code generation worker\n");
+	if (!w->pid) {
+		struct mem out;
+		char *s;
+		long len, n = 0;
+		close(fds[0]);
+		mem_init(&out);
+		for (i = 0; i < cg_n; i++)
+			func_gen(&cg_func[i], &out);
+		s = mem_buf(&out);
+		len = mem_len(&out);
+		while (len > 0 && (n = write(fds[1], s, len)) > 0) {
+			s += n;
+			len -= n;
+		}
+		_exit(len > 0);
+	}
+	close(fds[1]);
+	for (i = 0; i < cg_n; i++)
+		func_free(&cg_func[i]);
+	w->fd = fds[0];
+	w->f = cg_func;
+	w->f_n = cg_n;
+	cg_cnt++;
+	cg_func = NULL;
+	cg_n = 0;
+	cg_sz = 0;
+	cg_ics = 0;
+}
+
+/* generate the code of functions in up to n worker processes */
+void o_parallel(int n)
+{
+#ifndef I_SERIAL
+	cg_max = n > 1 ? n : 0;
+	cg_w = mextend(cg_w, 0, cg_max, sizeof(cg_w[0]));
+#endif
+}
+
+/* the number of functions found in and missing from the code cache */
+void o_cachestat(long *hits, long *misses)
+{
+	*hits = cg_hits;
+	*misses = cg_miss;
+}
+
+void o_func_end(void)
+{
+	struct func f;
+	strcpy(f.name, func_name);
+	f.flags = func_flags;
+	f.sym = func_sym;
+	f.argc = func_argc;
+	f.varg = func_varg;
+	prof_beg(PR_IC);
+	ic_get(&f.ic, &f.ic_n);		/* the intermediate code */
+	prof_end();
+	prof_span(NULL);
+	f.loc_off = loc_off;
+	f.loc_n = loc_n;
+	f.loc_pos = loc_pos;
+	loc_off = NULL;
 	ic_reset();
+	prof_beg(PR_FUNC);
+	if (cg_max) {
+		if (cg_n >= cg_sz) {
+			cg_sz = MAX(128, cg_sz * 2);
+			cg_func = mextend(cg_func, cg_n, cg_sz, sizeof(cg_func[0]));
+		}
+		cg_func[cg_n++] = f;
+		cg_ics += f.ic_n;
+		if (cg_ics >= CG_BATCH)
+			cg_fork();
+	} else {
+		struct mem out;
+		char *s;
+		mem_init(&out);
+		func_gen(&f, &out);
+		s = mem_buf(&out);
+		func_put(&f, &s);
+		mem_done(&out);
+	}
+	prof_end();
 }
 
-void o_write(int fd)
+/* release the state of the code generator */
+void o_done(void)
 {
-	i_done();
-	out_write(fd, mem_buf(&cs), mem_len(&cs), mem_buf(&ds), mem_len(&ds));
+	long i;
+	while (cg_cnt) {		/* abandoned workers after errors */
+		struct cgw *w = &cg_w[cg_beg];
+		close(w->fd);
+		waitpid(w->pid, NULL, 0);
+		free(w->f);
+		cg_beg = (cg_beg + 1) % cg_max;
+		cg_cnt--;
+	}
+	for (i = 0; i < cg_n; i++)
+		func_free(&cg_func[i]);
+	free(cg_func);
+	free(cg_w);
+	cg_func = NULL;
+	cg_n = 0;
+	cg_sz = 0;
+	cg_ics = 0;
+	cg_w = NULL;
+	cg_beg = 0;
+	cg_max = 0;
 	free(loc_off);
 	free(ds_name);
 	free(ds_off);
+	htab_done(&ds_tab);
+	free(rs_off);
+	htab_done(&rs_tab);
+	free(jtab_off);
+	free(jtab_sym);
+	loc_off = NULL;
+	loc_n = 0;
+	loc_sz = 0;
+	ds_name = NULL;
+	ds_off = NULL;
+	ds_n = 0;
+	ds_sz = 0;
+	rs_off = NULL;
+	rs_n = 0;
+	rs_sz = 0;
+	jtab_off = NULL;
+	jtab_sym = NULL;
+	jtab_n = 0;
+	jtab_sz = 0;
+	bsslen = 0;
+	cs_out = 0;
+	cs_fd = -1;
+	cs_err = 0;
 	mem_done(&cs);
 	mem_done(&ds);
+	mem_done(&rs);
+}
+
+/* wait for the code of all functions */
+static void o_finish(void)
+{
+	prof_beg(PR_FUNC);
+	if (cg_n)
+		cg_fork();
+	while (cg_cnt)
+		cg_wait();
+	i_done();
+	prof_end();
+}
+
+/*
+ * Write the object file to fd or, if obj is not NULL, to obj.  Return
+ * nonzero if writing fails.
+ */
+int o_write(int fd, struct mem *obj)
+{
+	int err;
+	o_finish();
+	prof_beg(PR_OUT);
+	err = out_write(fd, obj, mem_buf(&cs), mem_len(&cs),
+			mem_buf(&ds), mem_len(&ds),
+			mem_buf(&rs), mem_len(&rs)) || cs_err;
+	prof_end();
+	o_done();
+	return err;
+}
+
+/* load the object into this process; see out_load() */
+void *o_image(void)
+{
+	void *img;
+	o_finish();
+	img = out_load(mem_buf(&cs), mem_len(&cs), mem_buf(&ds), mem_len(&ds),
+			mem_buf(&rs), mem_len(&rs));
+	o_done();
+	return img;
 }
@@ -12,8 +12,20 @@ static long *lab_loc;		/* label locations */
 static long lab_n, lab_sz;	/* number of labels in lab_loc[] */
 static long lab_last;		/* the last label target */
 
+/* the facts known about each instruction of ic[]; see ic_note() */
+static struct icfact {
+	long num;		/* the value if isnum or the symbol if issym */
+	long soff;		/* symbol offset, if issym */
+	long base, boff;	/* base value and offset, if isoff */
+	int st;			/* the number of stores before it */
+	char isnum, issym, isoff;
+} *ic_fact;
+static long ic_factsz;		/* the size of ic_fact[] */
+static int ic_stn;		/* the number of stores in ic[] */
+
 static int io_num(void);
 static int io_mul2(void);
+static int io_div(void);
 static int io_cmp(void);
 static int io_jmp(void);
 static int io_addr(void);
@@ -23,6 +35,9 @@ static int io_call(void);
 static void io_deadcode(void);
 
 static void iv_put(long n);
+static void ic_note(long iv);
+static int iv_cnum(long iv, long *n);
+static int iv_csym(long iv, long *sym, long *off);
 
 static struct ic *ic_put(long op, long arg1, long arg2, long arg3)
 {
@@ -31,11 +46,19 @@ static struct ic *ic_put(long op, long arg1, long arg2, long arg3)
 		ic_sz = MAX(128, ic_sz * 2);
 		ic = mextend(ic, ic_n, ic_sz, sizeof(*ic));
 	}
+	if (ic_n == ic_factsz) {
+		ic_factsz = MAX(128, ic_factsz * 2);
+		ic_fact = realloc(ic_fact, ic_factsz * sizeof(*ic_fact));
+	}
 	c = &ic[ic_n++];
 	c->op = op;
 	c->a1 = arg1;
 	c->a2 = arg2;
 	c->a3 = arg3;
+	ic_fact[ic_n - 1].st = ic_stn;
+	if (op & O_ST)
+		ic_stn++;
+	ic_note(ic_n - 1);
 	if (op & O_OUT)
 		iv_put(ic_n - 1);
 	return c;
@@ -44,24 +67,36 @@ static struct ic *ic_put(long op, long arg1, long arg2, long arg3)
 static void ic_back(long pos)
 {
 	int i;
+	if (pos < ic_n)
+		ic_stn = ic_fact[pos].st;
 	for (i = pos; i < ic_n; i++)
-		if (ic[i].op & O_CALL)
-			free(ic[i].args);
+		ic_free(&ic[i]);
 	ic_n = pos;
 }
 
+/* check that the operand stack holds at least n values */
+static void iv_need(int n)
+{
+	if (iv_n < n)
+		err("expression expected\n");
+}
+
 static long iv_pop(void)
 {
+	iv_need(1);
 	return iv[--iv_n];
 }
 
 static long iv_get(int n)
 {
+	iv_need(n + 1);
 	return iv[iv_n - n - 1];
 }
 
 static void iv_put(long n)
 {
+	if (iv_n >= NTMPS)
+		err("expression too complex\n");
 	iv[iv_n++] = n;
 }
 
@@ -72,15 +107,16 @@ static void iv_drop(int n)
 
 static void iv_swap(int x, int y)
 {
-	long v = iv[iv_n - x - 1];
+	long v;
+	iv_need(MAX(x, y) + 1);
+	v = iv[iv_n - x - 1];
 	iv[iv_n - x - 1] = iv[iv_n - y - 1];
 	iv[iv_n - y - 1] = v;
 }
 
 static void iv_dup(void)
 {
-	iv[iv_n] = iv[iv_n - 1];
-	iv_n++;
+	iv_put(iv_get(0));
 }
 
 void o_num(long n)
@@ -98,6 +134,11 @@ void o_sym(char *sym)
 	ic_put(O_MOV | O_SYM, out_sym(sym), 0, 0);
 }
 
+void o_symoff(char *sym, long off)
+{
+	ic_put(O_MOV | O_SYM, out_sym(sym), off, 0);
+}
+
 void o_tmpdrop(int n)
 {
 	iv_drop(n >= 0 ? n : iv_n);
@@ -120,18 +161,12 @@ static int ic_const(long iv)
 	return oc & O_MOV && oc & (O_NUM | O_SYM | O_LOC);
 }
 
-/* return one if the given value is a simple load */
+/* return one if the given value is a simple load not followed by stores */
 static int ic_load(long iv)
 {
 	long oc = O_C(ic[iv].op);
-	int i;
-	if (oc & O_LD && oc & (O_NUM | O_SYM | O_LOC)) {
-		for (i = iv + 1; i < ic_n; i++)
-			if (ic[i].op & O_ST)
-				return 0;
-		return 1;
-	}
-	return 0;
+	return oc & O_LD && oc & (O_NUM | O_SYM | O_LOC) &&
+		ic_fact[iv].st == ic_stn;
 }
 
 void o_bop(long op)
@@ -145,10 +180,13 @@ void o_bop(long op)
 	}
 	ic_put(op, r2, r1, 0);
 	if (opt(1)) {
+		prof_beg(PR_IC);
 		io_num();
 		io_mul2();
+		io_div();
 		io_addr();
 		io_imm();
+		prof_end();
 	}
 }
 
@@ -157,8 +195,10 @@ void o_uop(long op)
 	int r1 = iv_pop();
 	ic_put(op, r1, 0, 0);
 	if (opt(1)) {
+		prof_beg(PR_IC);
 		io_num();
 		io_cmp();
+		prof_end();
 	}
 }
 
@@ -173,16 +213,22 @@ void o_assign(long bt)
 	}
 	ic_put(O_MK(O_ST | O_NUM, bt), rv, lv, 0);
 	iv_put(rv);
-	if (opt(1))
+	if (opt(1)) {
+		prof_beg(PR_IC);
 		io_loc();
+		prof_end();
+	}
 }
 
 void o_deref(long bt)
 {
 	int r1 = iv_pop();
 	ic_put(O_MK(O_LD | O_NUM, bt), r1, 0, 0);
-	if (opt(1))
+	if (opt(1)) {
+		prof_beg(PR_IC);
 		io_loc();
+		prof_end();
+	}
 }
 
 void o_cast(long bt)
@@ -190,8 +236,11 @@ void o_cast(long bt)
 	if (T_SZ(bt) != ULNG) {
 		int r1 = iv_pop();
 		ic_put(O_MK(O_MOV, bt), r1, 0, 0);
-		if (opt(1))
+		if (opt(1)) {
+			prof_beg(PR_IC);
 			io_num();
+			prof_end();
+		}
 	}
 }
 
@@ -230,8 +279,11 @@ void o_call(int argc, int ret)
 	c = ic_put(O_CALL, r1, 0, argc);
 	c->args = args;
 	iv_drop(ret == 0);
-	if (opt(1))
+	if (opt(1)) {
+		prof_beg(PR_IC);
 		io_call();
+		prof_end();
+	}
 }
 
 void o_ret(int ret)
@@ -261,13 +313,26 @@ void o_jmp(long id)
 void o_jz(long id)
 {
 	ic_put(O_JZ, iv_pop(), 0, id);
-	if (opt(1))
+	if (opt(1)) {
+		prof_beg(PR_IC);
 		io_jmp();
+		prof_end();
+	}
+}
+
+/* jump to label ids[v]; v is popped and should be less than n */
+void o_jtab(long *ids, long n)
+{
+	struct ic *c;
+	long *args = malloc(n * sizeof(c->args[0]));
+	memcpy(args, ids, n * sizeof(args[0]));
+	c = ic_put(O_JTAB, iv_pop(), n, o_jtabnew(n));
+	c->args = args;
 }
 
 int o_popnum(long *n)
 {
-	if (ic_num(ic, iv_get(0), n))
+	if (iv_cnum(iv_get(0), n))
 		return 1;
 	iv_drop(1);
 	return 0;
@@ -275,7 +340,7 @@ int o_popnum(long *n)
 
 int o_popsym(long *sym, long *off)
 {
-	if (ic_sym(ic, iv_get(0), sym, off))
+	if (iv_csym(iv_get(0), sym, off))
 		return 1;
 	iv_drop(1);
 	return 0;
@@ -291,14 +356,26 @@ void o_back(long mark)
 	ic_back(mark);
 }
 
+/* the instruction of label id */
+static long lab_get(long id)
+{
+	if (id < 0 || id >= lab_n || lab_loc[id] < 0)
+		err("undefined label\n");
+	return lab_loc[id];
+}
+
 void ic_get(struct ic **c, long *n)
 {
-	int i;
+	int i, j;
 	if (!ic_n || ~ic[ic_n - 1].op & O_RET || lab_last == ic_n)
 		o_ret(0);
-	for (i = 0; i < ic_n; i++)	/* filling branch targets */
+	for (i = 0; i < ic_n; i++) {	/* filling branch targets */
 		if (ic[i].op & O_JXX)
-			ic[i].a3 = lab_loc[ic[i].a3];
+			ic[i].a3 = lab_get(ic[i].a3);
+		if (ic[i].op & O_JTAB)
+			for (j = 0; j < ic[i].a2; j++)
+				ic[i].args[j] = lab_get(ic[i].args[j]);
+	}
 	io_deadcode();			/* removing dead code */
 	*c = ic;
 	*n = ic_n;
@@ -306,6 +383,7 @@ void ic_get(struct ic **c, long *n)
 	ic_n = 0;
 	ic_sz = 0;
 	iv_n = 0;
+	ic_stn = 0;
 	free(lab_loc);
 	lab_loc = NULL;
 	lab_n = 0;
@@ -315,10 +393,29 @@ void ic_get(struct ic **c, long *n)
 
 void ic_free(struct ic *ic)
 {
-	if (ic->op & O_CALL)
+	if (ic->op & (O_CALL | O_JTAB))
 		free(ic->args);
 }
 
+/* discard the instructions of an unfinished function */
+void ic_done(void)
+{
+	ic_back(0);
+	free(ic);
+	free(ic_fact);
+	free(lab_loc);
+	ic = NULL;
+	ic_fact = NULL;
+	ic_factsz = 0;
+	ic_stn = 0;
+	ic_sz = 0;
+	iv_n = 0;
+	lab_loc = NULL;
+	lab_n = 0;
+	lab_sz = 0;
+	lab_last = 0;
+}
+
 /* intermediate code queries */
 
 static long cb(long op, long *r, long a, long b)
@@ -345,12 +442,12 @@ static long cb(long op, long *r, long a, long b)
 	case O_DIV:
 		if (!b)
 			return 1;
-		*r = a / b;
+		*r = O_T(op) & T_MSIGN ? a / b : (unsigned long) a / b;
 		break;
 	case O_MOD:
 		if (!b)
 			return 1;
-		*r = a % b;
+		*r = O_T(op) & T_MSIGN ? a % b : (unsigned long) a % b;
 		break;
 	case O_SHL:
 		*r = a << b;
@@ -462,39 +559,97 @@ int ic_sym(struct ic *ic, long iv, long *sym, long *off)
 	return 1;
 }
 
-static int ic_off(struct ic *ic, long iv, long *base_iv, long *off)
+/*
+ * Compute the facts of instruction iv from those of its operands:
+ * its value if constant (like ic_num()), its symbol and offset (like
+ * ic_sym()) and its base value and offset.  This is done when an
+ * instruction is added or modified, so that the optimizations below
+ * need not follow operand chains.
+ */
+static void ic_note(long iv)
 {
-	long n;
-	long oc = O_C(ic[iv].op);
-	if (oc == (O_ADD | O_NUM)) {
-		*base_iv = ic[iv].a1;
-		*off = ic[iv].a2;
-		return 0;
+	struct ic *c = &ic[iv];
+	struct icfact *f = &ic_fact[iv];
+	struct icfact *f1 = NULL, *f2 = NULL;
+	long oc = O_C(c->op);
+	long bt = O_T(c->op);
+	int imm = (oc & (O_NUM | O_LOC | O_SYM)) != 0;
+	if (!imm && oc & (O_BOP | O_UOP | O_MOV))
+		f1 = &ic_fact[c->a1];
+	if (!imm && oc & O_BOP)
+		f2 = &ic_fact[c->a2];
+	f->isnum = 0;
+	f->issym = 0;
+	f->isoff = 1;
+	f->num = 0;
+	f->base = iv;
+	f->boff = 0;
+	if (oc & O_MOV && oc & O_NUM) {
+		f->isnum = 1;
+		f->num = c->a1;
 	}
-	if (oc == (O_SUB | O_NUM)) {
-		*base_iv = ic[iv].a1;
-		*off = -ic[iv].a2;
-		return 0;
+	if (oc & O_MOV && oc & O_SYM) {
+		f->issym = 1;
+		f->num = c->a1;
+		f->soff = c->a2;
 	}
-	if (oc == O_ADD) {
-		if ((ic_off(ic, ic[iv].a1, base_iv, off) ||
-				ic_num(ic, ic[iv].a2, &n)) &&
-			(ic_off(ic, ic[iv].a2, base_iv, off) ||
-				ic_num(ic, ic[iv].a1, &n)))
-			return 1;
-		*off += n;
-		return 0;
+	if (oc == (O_ADD | O_NUM) || oc == (O_SUB | O_NUM)) {
+		f->base = c->a1;
+		f->boff = oc == (O_SUB | O_NUM) ? -c->a2 : c->a2;
 	}
-	if (oc == O_SUB) {
-		if (ic_off(ic, ic[iv].a1, base_iv, off) ||
-				ic_num(ic, ic[iv].a2, &n))
-			return 1;
-		*off -= n;
-		return 0;
+	if (!f1)
+		return;
+	if (oc & O_BOP)
+		f->isnum = f1->isnum && f2->isnum &&
+			!cb(c->op, &f->num, f1->num, f2->num);
+	if (oc & O_UOP && (f->isnum = f1->isnum))
+		f->num = cu(c->op, f1->num);
+	if (oc & O_MOV && (f->isnum = f1->isnum))
+		f->num = c_cast(f1->num, bt);
+	if (oc != O_ADD && oc != O_SUB)
+		return;
+	if (f1->issym && f2->isnum) {
+		f->issym = 1;
+		f->num = f1->num;
+		f->soff = oc == O_ADD ? f1->soff + f2->num : f1->soff - f2->num;
+	} else if (oc == O_ADD && f2->issym && f1->isnum) {
+		f->issym = 1;
+		f->num = f2->num;
+		f->soff = f2->soff + f1->num;
 	}
-	*base_iv = iv;
-	*off = 0;
-	return 0;
+	f->isoff = 0;
+	if (f1->isoff && f2->isnum) {
+		f->isoff = 1;
+		f->base = f1->base;
+		f->boff = oc == O_ADD ? f1->boff + f2->num : f1->boff - f2->num;
+	} else if (oc == O_ADD && f2->isoff && f1->isnum) {
+		f->isoff = 1;
+		f->base = f2->base;
+		f->boff = f2->boff + f1->num;
+	}
+}
+
+/* the constant value of iv; see ic_note() */
+static int iv_cnum(long iv, long *n)
+{
+	*n = ic_fact[iv].num;
+	return !ic_fact[iv].isnum;
+}
+
+/* the symbol and offset of iv */
+static int iv_csym(long iv, long *sym, long *off)
+{
+	*sym = ic_fact[iv].num;
+	*off = ic_fact[iv].soff;
+	return !ic_fact[iv].issym;
+}
+
+/* the base value and offset of iv */
+static int iv_coff(long iv, long *base_iv, long *off)
+{
+	*base_iv = ic_fact[iv].base;
+	*off = ic_fact[iv].boff;
+	return !ic_fact[iv].isoff;
 }
 
 /* number of register arguments */
@@ -517,6 +672,8 @@ int ic_regcnt(struct ic *ic)
 		return 1;
 	if (o & O_JCC)
 		return o & (O_NUM | O_SYM | O_LOC) ? 1 : 2;
+	if (o & O_JTAB)
+		return 1;
 	if (o & O_RET)
 		return 1;
 	if (o & O_LD)
@@ -561,7 +718,7 @@ long *ic_lastuse(struct ic *ic, long ic_n)
 static int io_num(void)
 {
 	long n;
-	if (!ic_num(ic, iv_get(0), &n)) {
+	if (!iv_cnum(iv_get(0), &n)) {
 		iv_drop(1);
 		o_num(n);
 		return 0;
@@ -573,7 +730,7 @@ static int log2a(unsigned long n)
 {
 	int i = 0;
 	for (i = 0; i < LONGSZ * 8; i++)
-		if (n & (1u << i))
+		if (n & (1ul << i))
 			break;
 	if (i == LONGSZ * 8 || !(n >> (i + 1)))
 		return i;
@@ -596,12 +753,13 @@ static int io_mul2(void)
 	long bt = O_T(ic[iv].op);
 	if (!(oc & O_MUL))
 		return 1;
-	if (oc == O_MUL && !ic_num(ic, ic[iv].a1, &n)) {
+	if (oc == O_MUL && !iv_cnum(ic[iv].a1, &n)) {
 		long t = ic[iv].a1;
 		ic[iv].a1 = ic[iv].a2;
 		ic[iv].a2 = t;
+		ic_note(iv);
 	}
-	if (ic_num(ic, ic[iv].a2, &n))
+	if (iv_cnum(ic[iv].a2, &n))
 		return 1;
 	p = log2a(n);
 	if (n && p < 0)
@@ -646,6 +804,170 @@ static int io_mul2(void)
 	return 1;
 }
 
+#define LBITS		(LONGSZ * 8)
+#define LMASK		(~0ul >> (sizeof(long) * 8 - LBITS))
+
+/* sign extend a target long */
+static long lsx(unsigned long n)
+{
+	unsigned long s = LMASK / 2 + 1;
+	return (long) (((n & LMASK) ^ s) - s);
+}
+
+/* magic number for unsigned division by d (hacker's delight, magicu2) */
+static unsigned long magicu(unsigned long d, int *sh, int *add)
+{
+	unsigned long smax = LMASK / 2;
+	unsigned long q = smax / d;
+	unsigned long r = smax - q * d;
+	unsigned long p2 = 0, delta;
+	int p = LBITS - 1;
+	*add = 0;
+	do {
+		p++;
+		p2 = p == LBITS ? 1 : p2 * 2;
+		if (r + 1 >= d - r) {
+			if (q >= smax)
+				*add = 1;
+			q = (q * 2 + 1) & LMASK;
+			r = (r * 2 + 1 - d) & LMASK;
+		} else {
+			if (q >= smax + 1)
+				*add = 1;
+			q = (q * 2) & LMASK;
+			r = (r * 2 + 1) & LMASK;
+		}
+		delta = d - 1 - r;
+	} while (p < LBITS * 2 && p2 < delta);
+	*sh = p - LBITS;
+	return (q + 1) & LMASK;
+}
+
+/* magic number for signed division by d (hacker's delight, magic) */
+static unsigned long magics(long d, int *sh)
+{
+	unsigned long two = LMASK / 2 + 1;
+	unsigned long ad = d < 0 ? -(unsigned long) d : d;
+	unsigned long t = two + (d < 0);
+	unsigned long anc = t - 1 - t % ad;
+	unsigned long q1 = two / anc, r1 = two - q1 * anc;
+	unsigned long q2 = two / ad, r2 = two - q2 * ad;
+	unsigned long delta;
+	int p = LBITS - 1;
+	do {
+		p++;
+		q1 = (q1 * 2) & LMASK;
+		r1 = r1 * 2;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 = (q2 * 2) & LMASK;
+		r2 = r2 * 2;
+		if (r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && !r1));
+	*sh = p - LBITS;
+	return (d < 0 ? -(q2 + 1) : q2 + 1) & LMASK;
+}
+
+/* push the quotient of value x and constant d */
+static void io_divnum(long x, long d, int sgn)
+{
+	unsigned long ad = sgn && d < 0 ? -(unsigned long) d : d;
+	long m, t;
+	int sh, add, p;
+	if (d == 1) {
+		iv_put(x);
+		return;
+	}
+	if (!sgn && ad > LMASK / 2) {	/* the quotient is either 0 or 1 */
+		iv_put(x);
+		o_num(d);
+		o_bop(O_MK(O_GE, ULNG));
+		return;
+	}
+	if (!sgn) {
+		m = magicu(d, &sh, &add);
+		iv_put(x);
+		o_num(m);
+		o_bop(O_MK(O_MULH, ULNG));
+		if (add) {
+			t = iv_pop();
+			iv_put(x);
+			iv_put(t);
+			o_bop(O_SUB);
+			o_num(1);
+			o_bop(O_MK(O_SHR, ULNG));
+			iv_put(t);
+			o_bop(O_ADD);
+			sh--;
+		}
+		o_num(sh);
+		o_bop(O_MK(O_SHR, ULNG));
+		return;
+	}
+	p = log2a(ad);
+	if (p > 0) {			/* rounding towards zero */
+		iv_put(x);
+		o_num(p - 1);
+		o_bop(O_MK(O_SHR, SLNG));
+		o_num(LBITS - p);
+		o_bop(O_MK(O_SHR, ULNG));
+		iv_put(x);
+		o_bop(O_ADD);
+		o_num(p);
+		o_bop(O_MK(O_SHR, SLNG));
+		if (d < 0)
+			o_uop(O_NEG);
+	} else {
+		m = lsx(magics(d, &sh));
+		iv_put(x);
+		o_num(m);
+		o_bop(O_MK(O_MULH, SLNG));
+		if ((d > 0 && m < 0) || (d < 0 && m > 0)) {
+			iv_put(x);
+			o_bop(d > 0 ? O_ADD : O_SUB);
+		}
+		o_num(sh);
+		o_bop(O_MK(O_SHR, SLNG));
+		t = iv_pop();
+		iv_put(t);
+		iv_put(t);
+		o_num(LBITS - 1);
+		o_bop(O_MK(O_SHR, ULNG));
+		o_bop(O_ADD);
+	}
+}
+
+/* optimised division and modulo by constants via multiply-high */
+static int io_div(void)
+{
+	long iv = iv_get(0);
+	long oc = O_C(ic[iv].op);
+	int sgn = O_T(ic[iv].op) & T_MSIGN;
+	long x = ic[iv].a1;
+	long d;
+	if ((oc != O_DIV && oc != O_MOD) || iv_cnum(ic[iv].a2, &d))
+		return 1;
+	d = sgn ? lsx(d) : (long) (d & LMASK);
+	if (!d || (sgn && (d == -1 || d == -(long) (LMASK / 2) - 1)))
+		return 1;
+	iv_drop(1);
+	io_divnum(x, d, sgn);
+	if (oc == O_MOD) {
+		iv_put(x);
+		o_tmpswap();
+		o_num(d);
+		o_bop(O_MUL);
+		o_bop(O_SUB);
+	}
+	return 0;
+}
+
 /* optimise comparison */
 static int io_cmp(void)
 {
@@ -654,6 +976,7 @@ static int io_cmp(void)
 	if (O_C(ic[iv].op) == O_LNOT && ic[cmp].op & O_CMP) {
 		iv_drop(1);
 		ic[cmp].op ^= 1;
+		ic_note(cmp);
 		iv_put(cmp);
 		return 0;
 	}
@@ -684,7 +1007,7 @@ static int io_jmp(void)
 static int io_addr(void)
 {
 	long iv, off;
-	if (ic_off(ic, iv_get(0), &iv, &off) || iv == iv_get(0))
+	if (iv_coff(iv_get(0), &iv, &off) || iv == iv_get(0))
 		return 1;
 	if (ic[iv].op & O_MOV && ic[iv].op & O_LOC) {
 		iv_drop(1);
@@ -713,7 +1036,7 @@ static int io_loc(void)
 	struct ic *c = &ic[ic_n - 1];
 	long iv, off;
 	if (c->op & O_LD && c->op & O_NUM) {
-		if (ic_off(ic, c->a1, &iv, &off))
+		if (iv_coff(c->a1, &iv, &off))
 			return 1;
 		if (ic[iv].op & O_MOV && ic[iv].op & O_LOC) {
 			c->op = (c->op & ~O_NUM) | O_LOC;
@@ -728,7 +1051,7 @@ static int io_loc(void)
 		return 0;
 	}
 	if (c->op & O_ST && c->op & O_NUM) {
-		if (ic_off(ic, c->a2, &iv, &off))
+		if (iv_coff(c->a2, &iv, &off))
 			return 1;
 		if (ic[iv].op & O_MOV && ic[iv].op & O_LOC) {
 			c->op = (c->op & ~O_NUM) | O_LOC;
@@ -762,32 +1085,34 @@ static int io_imm(void)
 		return 1;
 	if (oc == O_ADD || oc == O_MUL || oc == O_AND || oc == O_OR ||
 			oc == O_XOR || oc == O_EQ || oc == O_NE) {
-		if (!ic_num(ic, c->a1, &n)) {
+		if (!iv_cnum(c->a1, &n)) {
 			long t = c->a1;
 			c->a1 = c->a2;
 			c->a2 = t;
+			ic_note(ic_n - 1);
 		}
 	}
 	if (oc == O_LT || oc == O_GE || oc == O_LE || oc == O_GT) {
-		if (!ic_num(ic, c->a1, &n)) {
+		if (!iv_cnum(c->a1, &n)) {
 			int t = c->a1;
 			c->a1 = c->a2;
 			c->a2 = t;
 			c->op = flip_cond(c->op);
+			ic_note(ic_n - 1);
 		}
 	}
-	if (oc & O_JCC && !ic_num(ic, c->a1, &n)) {
+	if (oc & O_JCC && !iv_cnum(c->a1, &n)) {
 		int t = c->a1;
 		c->a1 = c->a2;
 		c->a2 = t;
 		c->op = flip_cond(c->op);
 	}
-	if (oc & O_JCC && !ic_num(ic, c->a2, &n) && imm_ok(c->op, n, 2)) {
+	if (oc & O_JCC && !iv_cnum(c->a2, &n) && imm_ok(c->op, n, 2)) {
 		c->op |= O_NUM;
 		c->a2 = n;
 		return 0;
 	}
-	if (!(oc & O_BOP) || ic_num(ic, c->a2, &n))
+	if (!(oc & O_BOP) || iv_cnum(c->a2, &n))
 		return 1;
 	if ((oc == O_ADD || oc == O_SUB || oc & O_SHL) && n == 0) {
 		iv_drop(1);
@@ -797,6 +1122,7 @@ static int io_imm(void)
 	if (imm_ok(c->op, n, 2)) {
 		c->op |= O_NUM;
 		c->a2 = n;
+		ic_note(ic_n - 1);
 		return 0;
 	}
 	return 1;
@@ -807,7 +1133,7 @@ static int io_call(void)
 {
 	struct ic *c = &ic[ic_n - 1];
 	long sym, off;
-	if (c->op & O_CALL && !ic_sym(ic, c->a1, &sym, &off) && !off) {
+	if (c->op & O_CALL && !iv_csym(c->a1, &sym, &off) && !off) {
 		c->op |= O_SYM;
 		c->a1 = sym;
 		return 0;
@@ -870,6 +1196,9 @@ static void io_deadcode(void)
 		if (ic[i].op & O_CALL)
 			for (j = 0; j < ic[i].a3; j++)
 				ic[i].args[j] = nidx[ic[i].args[j]];
+		if (ic[i].op & O_JTAB)
+			for (j = 0; j < ic[i].a2; j++)
+				ic[i].args[j] = nidx[ic[i].args[j]];
 	}
 	free(live);
 	free(nidx);
@@ -0,0 +1,137 @@
+/* neatcc library interface */
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ncc.h"
+#include "libncc.h"
+
+struct ncc {
+	char **defs;		/* macro name and definition pairs */
+	int defs_n, defs_sz;
+	char **paths;		/* include directories */
+	int paths_n, paths_sz;
+	int opt;		/* optimization level */
+	char err[512];		/* the last error message */
+};
+
+static char *ncc_strdup(char *s)
+{
+	char *d = malloc(strlen(s) + 1);
+	strcpy(d, s);
+	return d;
+}
+
+struct ncc *ncc_new(void)
+{
+	struct ncc *ncc = malloc(sizeof(*ncc));
+	memset(ncc, 0, sizeof(*ncc));
+	ncc->opt = 2;
+	return ncc;
+}
+
+void ncc_free(struct ncc *ncc)
+{
+	int i;
+	for (i = 0; i < ncc->defs_n; i++)
+		free(ncc->defs[i]);
+	for (i = 0; i < ncc->paths_n; i++)
+		free(ncc->paths[i]);
+	free(ncc->defs);
+	free(ncc->paths);
+	free(ncc);
+}
+
+void ncc_define(struct ncc *ncc, char *name, char *def)
+{
+	if (ncc->defs_n + 2 > ncc->defs_sz) {
+		ncc->defs_sz = MAX(16, ncc->defs_sz * 2);
+		ncc->defs = mextend(ncc->defs, ncc->defs_n, ncc->defs_sz,
+				sizeof(ncc->defs[0]));
+	}
+	ncc->defs[ncc->defs_n++] = ncc_strdup(name);
+	ncc->defs[ncc->defs_n++] = ncc_strdup(def);
+}
+
+void ncc_path(struct ncc *ncc, char *path)
+{
+	if (ncc->paths_n == ncc->paths_sz) {
+		ncc->paths_sz = MAX(16, ncc->paths_sz * 2);
+		ncc->paths = mextend(ncc->paths, ncc->paths_n, ncc->paths_sz,
+				sizeof(ncc->paths[0]));
+	}
+	ncc->paths[ncc->paths_n++] = ncc_strdup(path);
+}
+
+void ncc_optimize(struct ncc *ncc, int level)
+{
+	ncc->opt = level;
+}
+
+char *ncc_error(struct ncc *ncc)
+{
+	return ncc->err;
+}
+
+/* compile src into obj or, if obj is NULL, load it into img */
+static int ncc_build(struct ncc *ncc, char *name, char *src, long len,
+		struct mem *obj, void **img)
+{
+	jmp_buf env;
+	int i;
+	ncc->err[0] = '\0';
+	ncc_reset();
+	if (setjmp(env)) {
+		die_catch(NULL, NULL);
+		ncc_reset();
+		return 1;
+	}
+	die_catch(&env, ncc->err);
+	opt_set(ncc->opt);
+	ncc_macros();
+	for (i = 0; i < ncc->defs_n; i += 2)
+		cpp_define(ncc->defs[i], ncc->defs[i + 1]);
+	for (i = 0; i < ncc->paths_n; i++)
+		cpp_path(ncc->paths[i]);
+	cpp_initbuf(name, src, len);
+	out_init(obj ? 0 : OUT_LOAD);
+	i_init(obj ? 0 : OUT_LOAD);
+	ncc_parse();
+	if (obj)
+		o_write(-1, obj);
+	else
+		*img = o_image();
+	die_catch(NULL, NULL);
+	return 0;
+}
+
+int ncc_compile(struct ncc *ncc, char *name, char *src, long len,
+		char **obj, long *obj_len)
+{
+	static struct mem out;
+	mem_done(&out);
+	if (ncc_build(ncc, name, src, len, &out, NULL)) {
+		mem_done(&out);
+		return 1;
+	}
+	*obj_len = mem_len(&out);
+	*obj = mem_get(&out);
+	return 0;
+}
+
+void *ncc_load(struct ncc *ncc, char *name, char *src, long len)
+{
+	void *img = NULL;
+	if (ncc_build(ncc, name, src, len, NULL, &img))
+		return NULL;
+	return img;
+}
+
+void *ncc_sym(void *img, char *name)
+{
+	return out_addr(img, name);
+}
+
+void ncc_unload(void *img)
+{
+	out_unload(img);
+}
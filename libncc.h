@@ -0,0 +1,37 @@
+/* libncc: neatcc as a library */
+
+/*
+ * A compiler instance holds the options of compilations: predefined
+ * macros, include directories and the optimization level.  The
+ * compiler keeps its state in static variables, so compilations
+ * cannot run concurrently in one process; they may be repeated, however,
+ * and a failed compilation leaves the process intact.
+ */
+struct ncc;
+
+struct ncc *ncc_new(void);
+void ncc_free(struct ncc *ncc);
+/* define macro name as def ("" for empty definitions) */
+void ncc_define(struct ncc *ncc, char *name, char *def);
+/* add an include directory */
+void ncc_path(struct ncc *ncc, char *path);
+/* set the optimization level (-O) */
+void ncc_optimize(struct ncc *ncc, int level);
+/*
+ * Compile len bytes of C source src; name is used for diagnostics and
+ * relative includes.  On success, return zero and store a malloc()ed
+ * ELF object in obj and its length in obj_len.  On failure, return
+ * nonzero; ncc_error() returns the error message.
+ */
+int ncc_compile(struct ncc *ncc, char *name, char *src, long len,
+		char **obj, long *obj_len);
+char *ncc_error(struct ncc *ncc);
+/*
+ * Compile src like ncc_compile() but load the code into this process;
+ * undefined symbols are resolved against the process with dlsym().
+ * Return NULL on failure.  ncc_sym() returns the address of a global
+ * symbol of the loaded code and ncc_unload() unmaps it.
+ */
+void *ncc_load(struct ncc *ncc, char *name, char *src, long len);
+void *ncc_sym(void *img, char *name);
+void ncc_unload(void *img);
@@ -0,0 +1,284 @@
+/* neatcc command line driver */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "ncc.h"
+
+extern char **environ;
+
+static int cache_stats;		/* report cache hits and misses */
+static int time_report;		/* report the time of compilation phases */
+static int time_trace;		/* write the trace of compilation phases */
+static char out_part[128];	/* the object being written; removed on exit */
+
+static void out_rm(void)
+{
+	if (*out_part)
+		unlink(out_part);
+}
+
+/* remove the object at path, if it is a regular file, on failure */
+static void out_keep(char *path, int fd)
+{
+	struct stat st;
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+		strcpy(out_part, path);
+}
+
+/* compile (or preprocess if cpp is nonzero) the given file */
+static int compile(char *path, char *obj, int cpp)
+{
+	char out[128];
+	char key[64];
+	int ofd = 1;
+	int cache = 0;
+	strcpy(out, obj);
+	if (!cpp && !*out) {
+		char *cp = strrchr(path, '/');
+		strcpy(out, cp ? cp + 1 : path);
+		out[strlen(out) - 1] = 'o';
+	}
+	if (!cpp && !cache_key(path, key)) {
+		if (!cache_get(key, out)) {
+			if (cache_stats)
+				fprintf(stderr, "%s: cached object\n", path);
+			return 0;
+		}
+		cache = 1;
+	}
+	prof_init(!cpp && (time_report || time_trace));
+	if (cpp_init(path))
+		die("neatcc: cannot open <%s>\n", path);
+	if (cpp) {
+		long clen;
+		char *cbuf;
+		if (*out)
+			ofd = open(out, O_WRONLY | O_TRUNC | O_CREAT, 0600);
+		while (!cpp_read(&cbuf, &clen))
+			write(ofd, cbuf, clen);
+		if (*out)
+			close(ofd);
+		return 0;
+	}
+	out_init(0);
+	i_init(0);
+	if (!cache) {
+		if ((ofd = open(out, O_WRONLY | O_TRUNC | O_CREAT, 0600)) < 0)
+			die("neatcc: cannot create <%s>\n", out);
+		out_keep(out, ofd);
+		o_stream(ofd);
+	}
+	prof_beg(PR_PARSE);
+	ncc_parse();
+	prof_end();
+	if (cache) {
+		struct mem mem;
+		mem_init(&mem);
+		o_write(-1, &mem);
+		if ((ofd = open(out, O_WRONLY | O_TRUNC | O_CREAT, 0600)) < 0)
+			die("neatcc: cannot create <%s>\n", out);
+		out_keep(out, ofd);
+		if (write(ofd, mem_buf(&mem), mem_len(&mem)) != mem_len(&mem))
+			die("neatcc: cannot write <%s>\n", out);
+		cache_put(key, mem_buf(&mem), mem_len(&mem));
+		mem_done(&mem);
+	} else if (o_write(ofd, NULL)) {
+		die("neatcc: cannot write <%s>\n", out);
+	}
+	if (close(ofd))
+		die("neatcc: cannot write <%s>\n", out);
+	out_part[0] = '\0';
+	if (time_report)
+		prof_report(path);
+	if (time_trace) {
+		char *ext = strrchr(out, '.');
+		strcpy(ext && !strcmp(ext, ".o") ? ext : out + strlen(out), ".json");
+		if (prof_trace(out))
+			die("neatcc: cannot write <%s>\n", out);
+	}
+	if (cache_stats) {
+		long hits, misses;
+		o_cachestat(&hits, &misses);
+		fprintf(stderr, "%s: %ld cached functions, %ld missed\n",
+			path, hits, misses);
+	}
+	return 0;
+}
+
+/* compile the given file into the memory and call its main() */
+static int run(char *path, int argc, char **argv)
+{
+	int (*entry)(int argc, char **argv, char **envp);
+	void *img;
+	if (cpp_init(path))
+		die("neatcc: cannot open <%s>\n", path);
+	out_init(OUT_LOAD);
+	i_init(OUT_LOAD);
+	ncc_parse();
+	img = o_image();
+	if (!(entry = out_addr(img, "main")))
+		die("neatcc: main() is not defined in <%s>\n", path);
+	fflush(stdout);
+	exit(entry(argc, argv, environ));
+}
+
+/* a compilation job of the multi-file driver */
+struct job {
+	int pid;		/* process id */
+	int fd;			/* the pipe for reading its diagnostics */
+};
+
+/* wait for a job and print its diagnostics; return nonzero on failure */
+static int job_wait(struct job *job)
+{
+	char buf[1 << 12];
+	long n;
+	int status;
+	while ((n = read(job->fd, buf, sizeof(buf))) > 0)
+		write(2, buf, n);
+	close(job->fd);
+	if (waitpid(job->pid, &status, 0) < 0)
+		return 1;
+	return !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+/*
+ * Compile files[] in up to n processes.  Each file is compiled in a
+ * child process, forked before parsing anything, and the diagnostics
+ * of the files are printed in their order.
+ */
+static int compile_all(char **files, int files_n, int n, int cpp)
+{
+	struct job *jobs = malloc(n * sizeof(jobs[0]));
+	int beg = 0, cnt = 0;
+	int ret = 0;
+	int i;
+	for (i = 0; i < files_n || cnt; i++) {
+		struct job *job;
+		int fds[2];
+		if (cnt == n || (i >= files_n && cnt)) {
+			ret |= job_wait(&jobs[beg]);
+			beg = (beg + 1) % n;
+			cnt--;
+		}
+		if (i >= files_n)
+			continue;
+		job = &jobs[(beg + cnt) % n];
+		if (pipe(fds) || (job->pid = fork()) < 0)
+			die("neatcc: cannot start a job\n");
+		if (!job->pid) {
+			close(fds[0]);
+			dup2(fds[1], 2);
+			close(fds[1]);
+			exit(compile(files[i], "", cpp));
+		}
+		close(fds[1]);
+		job->fd = fds[0];
+		cnt++;
+	}
+	free(jobs);
+	return ret;
+}
+
+int ncc_main(int argc, char *argv[])
+{
+	char obj[128] = "";
+	int cpp = 0;
+	int jobs = 1;
+	int exec = 0;
+	char *cache_dir = NULL;
+	long cache_size = 1 << 10;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (argv[i][1] == 'I')
+			cpp_path(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'O')
+			opt_set(argv[i][2] ? atoi(argv[i] + 2) : 2);
+		if (argv[i][1] == 'E')
+			cpp = 1;
+		if (argv[i][1] == 'j')
+			jobs = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (!strncmp(argv[i] + 1, "fparallel-codegen=", 18))
+			o_parallel(atoi(argv[i] + 19));
+		if (argv[i][1] == 'D') {
+			char *name = argv[i] + 2;
+			char *def = "";
+			char *eq = strchr(name, '=');
+			if (eq) {
+				*eq = '\0';
+				def = eq + 1;
+			}
+			cpp_define(name, def);
+		}
+		if (!strncmp(argv[i] + 1, "fcache=", 7))
+			cache_dir = argv[i] + 8;
+		if (!strncmp(argv[i] + 1, "fcache-size=", 12))
+			cache_size = atol(argv[i] + 13);
+		if (!strcmp(argv[i], "-fcache-stats"))
+			cache_stats = 1;
+		if (!strcmp(argv[i], "-ftime-report"))
+			time_report = 1;
+		if (!strcmp(argv[i], "-ftime-trace"))
+			time_trace = 1;
+		if (!strcmp(argv[i], "-run"))
+			exec = 1;
+		if (argv[i][1] == 'o')
+			strcpy(obj, argv[i][2] ? argv[i] + 2 : argv[++i]);
+		if (argv[i][1] == 'h') {
+			printf("Usage: %s [options] source...\n", argv[0]);
+			printf("\n");
+			printf("Options:\n");
+			printf("  -I dir     \tspecify a header directory\n");
+			printf("  -o out     \tspecify output file name\n");
+			printf("  -E         \tpreprocess only\n");
+			printf("  -Dname=val \tdefine a macro\n");
+			printf("  -On        \toptimize (-O0 to disable)\n");
+			printf("  -j n       \tcompile the given files in n processes\n");
+			printf("  -run file args\tcompile and run file with args\n");
+			printf("  -fcache=dir\tcache objects and functions in dir\n");
+			printf("  -fcache-size=n\tlimit the size of the cache to n megabytes\n");
+			printf("  -fcache-stats\treport cache hits and misses\n");
+			printf("  -ftime-report\treport the time of compilation phases\n");
+			printf("  -ftime-trace\twrite a trace of compilation phases to out.json\n");
+			printf("  -fparallel-codegen=n\tgenerate code in n processes\n");
+			printf("  --server=sock\tserve compile requests on socket sock\n");
+			printf("  --client=sock\tsend the request to the server at sock\n");
+			return 0;
+		}
+	}
+	if (i == argc)
+		die("neatcc: no file given\n");
+	if (cache_dir && !exec)		/* the code differs with -run */
+		cache_set(cache_dir, cache_size << 20);
+	if (exec)
+		return run(argv[i], argc - i, argv + i);
+	if (i + 1 == argc)
+		return compile(argv[i], obj, cpp);
+	if (*obj)
+		die("neatcc: cannot specify -o with multiple files\n");
+	/* the output of the preprocessor should not be interleaved */
+	return compile_all(argv + i, argc - i, cpp || jobs < 1 ? 1 : jobs, cpp);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	if (argc > 1 && !strncmp(argv[1], "--client=", 9)) {
+		char *sock = argv[1] + 9;
+		argv[1] = argv[0];
+		argc--;
+		argv++;
+		if ((ret = srv_client(sock, argc, argv)) >= 0)
+			return ret;
+	}
+	atexit(out_rm);
+	ncc_macros();
+	if (argc > 1 && !strncmp(argv[1], "--server=", 9))
+		return srv_main(argv[1] + 9);
+	return ncc_main(argc, argv);
+}
@@ -83,3 +83,86 @@ void *mem_get(struct mem *mem)
 	mem_init(mem);
 	return ret;
 }
+
+/* the hash of a null-terminated string */
+unsigned hash(char *s)
+{
+	unsigned h = 0;
+	while (*s)
+		h = (h << 5) + h + (unsigned char) *s++;
+	return h;
+}
+
+static void htab_link(struct htab *t, int i)
+{
+	int b = t->hash[i] & (t->hsz - 1);
+	t->next[i] = t->head[b];
+	t->head[b] = i;
+}
+
+/* add an entry with hash h; return its index, which is t->n before */
+int htab_put(struct htab *t, unsigned h)
+{
+	int i;
+	if (t->n >= t->sz) {
+		int sz = MAX(128, t->sz * 2);
+		t->next = mextend(t->next, t->n, sz, sizeof(t->next[0]));
+		t->hash = mextend(t->hash, t->n, sz, sizeof(t->hash[0]));
+		t->sz = sz;
+	}
+	t->hash[t->n++] = h;
+	if (t->n > t->hsz) {
+		free(t->head);
+		t->hsz = MAX(256, t->hsz * 2);
+		t->head = malloc(t->hsz * sizeof(t->head[0]));
+		for (i = 0; i < t->hsz; i++)
+			t->head[i] = -1;
+		for (i = 0; i < t->n; i++)
+			htab_link(t, i);
+	} else {
+		htab_link(t, t->n - 1);
+	}
+	return t->n - 1;
+}
+
+/* the newest entry with hash h or -1; t->next[] gives older ones */
+int htab_get(struct htab *t, unsigned h)
+{
+	int i = t->hsz ? t->head[h & (t->hsz - 1)] : -1;
+	while (i >= 0 && t->hash[i] != h)
+		i = t->next[i];
+	return i;
+}
+
+/* the next older entry after i with the same hash or -1 */
+int htab_next(struct htab *t, int i)
+{
+	unsigned h = t->hash[i];
+	for (i = t->next[i]; i >= 0 && t->hash[i] != h; i = t->next[i])
+		;
+	return i;
+}
+
+/* remove the newest entry */
+void htab_pop(struct htab *t)
+{
+	int i = --t->n;
+	t->head[t->hash[i] & (t->hsz - 1)] = t->next[i];
+}
+
+/* remove all entries */
+void htab_clear(struct htab *t)
+{
+	int i;
+	for (i = 0; i < t->hsz; i++)
+		t->head[i] = -1;
+	t->n = 0;
+}
+
+void htab_done(struct htab *t)
+{
+	free(t->head);
+	free(t->next);
+	free(t->hash);
+	memset(t, 0, sizeof(*t));
+}
@@ -70,8 +70,24 @@ struct type {
 static struct type ts[NTMPS];
 static int nts;
 
+/* check that the type stack can hold n more entries */
+static void ts_room(int n)
+{
+	if (nts + n > NTMPS)
+		err("expression too complex\n");
+}
+
+/* the n-th entry from the top of the type stack */
+static struct type *ts_top(int n)
+{
+	if (n >= nts)
+		err("expression expected\n");
+	return &ts[nts - n - 1];
+}
+
 static void ts_push_bt(unsigned bt)
 {
+	ts_room(1);
 	ts[nts].ptr = 0;
 	ts[nts].flags = 0;
 	ts[nts].addr = 0;
@@ -83,18 +99,21 @@ static void ts_push_bt(unsigned bt)
 
 static void ts_push(struct type *t)
 {
-	struct type *d = &ts[nts++];
+	struct type *d;
+	ts_room(1);
+	d = &ts[nts++];
 	memcpy(d, t, sizeof(*t));
 }
 
 static void ts_push_addr(struct type *t)
 {
 	ts_push(t);
-	ts[nts - 1].addr = 1;
+	ts_top(0)->addr = 1;
 }
 
 static void ts_pop(struct type *type)
 {
+	ts_top(0);
 	nts--;
 	if (type)
 		*type = ts[nts];
@@ -130,6 +149,7 @@ static struct name *locals;
 static int locals_n, locals_sz;
 static struct name *globals;
 static int globals_n, globals_sz;
+static struct htab globals_tab;	/* globals[] hash table */
 
 static void local_add(struct name *name)
 {
@@ -152,7 +172,8 @@ static int local_find(char *name)
 static int global_find(char *name)
 {
 	int i;
-	for (i = globals_n - 1; i >= 0; i--)
+	for (i = htab_get(&globals_tab, hash(name)); i >= 0;
+			i = htab_next(&globals_tab, i))
 		if (!strcmp(name, globals[i].name))
 			return i;
 	return -1;
@@ -165,6 +186,14 @@ static void global_add(struct name *name)
 		globals = mextend(globals, globals_n, globals_sz, sizeof(globals[0]));
 	}
 	memcpy(&globals[globals_n++], name, sizeof(*name));
+	htab_put(&globals_tab, hash(name->name));
+}
+
+/* drop the globals defined after the first n */
+static void global_cut(int n)
+{
+	for (; globals_n > n; globals_n--)
+		htab_pop(&globals_tab);
 }
 
 #define LABEL()			(++label)
@@ -317,7 +346,7 @@ static unsigned type_szde(struct type *t)
 /* dereference stack top if t->addr (ie. address is pushed to gen.c) */
 static void ts_de(int deref)
 {
-	struct type *t = &ts[nts - 1];
+	struct type *t = ts_top(0);
 	array2ptr(t);
 	if (deref && t->addr && (t->ptr || !(t->flags & T_FUNC)))
 		o_deref(TYPE_BT(t));
@@ -362,6 +391,25 @@ static int tok_comes(char *tok)
 	return !strcmp(tok, tok_see());
 }
 
+/* like tok_get() but fail at the end of input */
+static char *tok_next(void)
+{
+	char *tok = tok_get();
+	if (!tok[0])
+		err("unexpected end of input\n");
+	return tok;
+}
+
+/* like tok_jmp() for loops ending at tok; fail at the end of input */
+static int tok_until(char *tok)
+{
+	if (!tok_jmp(tok))
+		return 0;
+	if (!tok_see()[0])
+		err("unexpected end of input\n");
+	return 1;
+}
+
 static void tok_req(char *tok)
 {
 	char *got = tok_get();
@@ -500,7 +548,7 @@ static int struct_create(char *name, int isunion)
 {
 	int id = struct_find(name, isunion);
 	tok_req("{");
-	while (tok_jmp("}")) {
+	while (tok_until("}")) {
 		readdefs(structdef, id);
 		tok_req(";");
 	}
@@ -513,7 +561,7 @@ static void enum_create(void)
 {
 	long n = 0;
 	tok_req("{");
-	while (tok_jmp("}")) {
+	while (tok_until("}")) {
 		char name[NAMELEN];
 		strcpy(name, tok_get());
 		if (!tok_jmp("=")) {
@@ -533,14 +581,21 @@ static int caseexpr;
 
 static void readpre(void);
 
-static char *tmp_str(char *buf, int len)
+static int tmp_id;		/* string literals in the data section */
+
+/* push the address of string literal buf */
+static void tmp_str(char *buf, int len)
 {
-	static char name[NAMELEN];
-	static int id;
-	sprintf(name, "__neatcc.s%d", id++);
+	char name[NAMELEN];
 	buf[len] = '\0';
+	if (strlen(buf) == len) {
+		o_symoff(OUT_RSSYM, o_rsnew(buf));
+		return;
+	}
+	/* strings with null bytes cannot be merged */
+	sprintf(name, "__neatcc.s%d", tmp_id++);
 	o_dscpy(o_dsnew(name, len + 1, 0), buf, len + 1);
-	return name;
+	o_sym(name);
 }
 
 static void readprimary(void)
@@ -560,7 +615,7 @@ static void readprimary(void)
 		t.bt = 1 | T_MSIGN;
 		a.id = array_add(&t, len + 1);
 		a.flags = T_ARRAY;
-		o_sym(tmp_str(buf, len));
+		tmp_str(buf, len);
 		ts_push(&a);
 		return;
 	}
@@ -608,7 +663,7 @@ static void readprimary(void)
 				o_cast(TYPE_BT(&t));
 		} else {
 			readexpr();
-			while (tok_jmp(")")) {
+			while (tok_until(")")) {
 				tok_req(",");
 				ts_pop(NULL);
 				o_tmpdrop(1);
@@ -644,7 +699,7 @@ static void arrayderef(void)
 
 static void inc_post(int op)
 {
-	struct type t = ts[nts - 1];
+	struct type t = *ts_top(0);
 	/* pushing the value before inc */
 	o_tmpcopy();
 	ts_de(1);
@@ -668,6 +723,8 @@ static void readfield(void)
 	struct type t;
 	ts_pop(&t);
 	array2ptr(&t);
+	if (!(t.flags & T_STRUCT))
+		err("struct expected\n");
 	field = struct_field(t.id, tok_get());
 	if (field->addr) {
 		o_num(field->addr);
@@ -776,7 +833,7 @@ static void inc_pre(int op)
 	readpre();
 	/* copy the destination */
 	o_tmpcopy();
-	ts_push(&ts[nts - 1]);
+	ts_push(ts_top(0));
 	/* increment by 1 or pointer size */
 	ts_pop_de(&t);
 	o_num(t.ptr > 0 ? type_szde(&t) : 1);
@@ -1166,7 +1223,7 @@ static void readcexpr(void)
 
 static void opassign(int op, int ptrop)
 {
-	struct type t = ts[nts - 1];
+	struct type t = *ts_top(0);
 	o_tmpcopy();
 	ts_push(&t);
 	readexpr();
@@ -1174,21 +1231,21 @@ static void opassign(int op, int ptrop)
 		ts_addop(op);
 	else
 		ts_binop(op);
-	o_assign(TYPE_BT(&ts[nts - 2]));
+	o_assign(TYPE_BT(ts_top(1)));
 	ts_pop(NULL);
 	ts_de(0);
 }
 
 static void doassign(void)
 {
-	struct type t = ts[nts - 1];
+	struct type t = *ts_top(0);
 	if (!t.ptr && t.flags & T_STRUCT) {
 		ts_pop(NULL);
 		o_num(type_totsz(&t));
 		o_memcpy();
 	} else {
 		ts_pop_de(NULL);
-		o_assign(TYPE_BT(&ts[nts - 1]));
+		o_assign(TYPE_BT(ts_top(0)));
 		ts_de(0);
 	}
 }
@@ -1317,7 +1374,7 @@ static void localinit(void *obj, int off, struct type *t)
 			char *buf = tok_get() + 1;
 			int len = tok_len() - 2;
 			o_localoff(addr, off);
-			o_sym(tmp_str(buf, len));
+			tmp_str(buf, len);
 			o_num(len + 1);
 			o_memcpy();
 			o_tmpdrop(1);
@@ -1371,15 +1428,92 @@ static void typedefdef(long data, struct name *name, unsigned flags)
 
 static void readstmt(void);
 
+#define SW_TABMIN	4	/* the minimum number of cases for jump tables */
+#define SW_TABDEN	3	/* the maximum range to cases ratio for jump tables */
+#define SW_LINMAX	3	/* the maximum number of cases compared linearly */
+
+/* a case label of a switch statement */
+struct swcase {
+	long val;		/* case value */
+	int lab;		/* case label */
+};
+
+/* the case labels of the switch statements being parsed */
+static struct swcase *cases;
+static int cases_n, cases_sz;
+
+static int swcase_cmp(const void *v1, const void *v2)
+{
+	const struct swcase *c1 = v1, *c2 = v2;
+	if (c1->val != c2->val)
+		return c1->val < c2->val ? -1 : 1;
+	return c1->lab - c2->lab;
+}
+
+/* load the value of the switch statement */
+static void swload(long addr, unsigned bt)
+{
+	o_local(addr);
+	o_deref(bt);
+}
+
+/* dispatch to the case matching the value stored at addr or jump to l_def */
+static void swdispatch(long addr, unsigned bt, struct swcase *cs, int n, int l_def)
+{
+	long min = n ? cs[0].val : 0;
+	long max = n ? cs[n - 1].val : 0;
+	int i;
+	if (n >= SW_TABMIN && (unsigned long) (max - min) <
+			(unsigned long) n * SW_TABDEN) {
+		long cnt = max - min + 1;
+		long *ids = malloc(cnt * sizeof(ids[0]));
+		for (i = 0; i < cnt; i++)
+			ids[i] = l_def;
+		for (i = 0; i < n; i++)
+			ids[cs[i].val - min] = cs[i].lab;
+		swload(addr, bt);
+		o_num(min);
+		o_bop(O_SUB);
+		o_num(max - min);
+		o_bop(O_MK(O_LE, ULNG));
+		o_jz(l_def);
+		swload(addr, bt);
+		o_num(min);
+		o_bop(O_SUB);
+		o_jtab(ids, cnt);
+		free(ids);
+		return;
+	}
+	if (n <= SW_LINMAX) {
+		for (i = 0; i < n; i++) {
+			swload(addr, bt);
+			o_num(cs[i].val);
+			o_bop(O_NE);
+			o_jz(cs[i].lab);
+		}
+		o_jmp(l_def);
+		return;
+	}
+	i = LABEL();
+	swload(addr, bt);
+	o_num(cs[n / 2].val);
+	o_bop(O_MK(O_GE, SLNG));
+	o_jz(i);
+	swdispatch(addr, bt, cs + n / 2, n - n / 2, l_def);
+	o_label(i);
+	swdispatch(addr, bt, cs, n / 2, l_def);
+}
+
 static void readswitch(void)
 {
 	int o_break = l_break;
 	long val_addr = o_mklocal(ULNG);
 	struct type t;
-	int ncases = 0;			/* number of case labels */
-	int l_failed = LABEL();		/* address of last failed jmp */
-	int l_matched = LABEL();	/* address of last walk through jmp */
+	int cases_beg = cases_n;	/* the first case of this switch */
+	int l_dispatch = LABEL();	/* case dispatch code */
 	int l_default = 0;		/* default case label */
+	long n;
+	int i;
 	l_break = LABEL();
 	tok_req("(");
 	readexpr();
@@ -1389,42 +1523,46 @@ static void readswitch(void)
 	o_assign(TYPE_BT(&t));
 	o_tmpdrop(1);
 	tok_req(")");
+	o_jmp(l_dispatch);
 	tok_req("{");
-	while (tok_jmp("}")) {
+	while (tok_until("}")) {
 		if (!tok_comes("case") && !tok_comes("default")) {
 			readstmt();
 			continue;
 		}
-		if (ncases)
-			o_jmp(l_matched);
 		if (!strcmp("case", tok_get())) {
-			o_label(l_failed);
-			l_failed = LABEL();
 			caseexpr = 1;
 			readexpr();
 			ts_pop_de(NULL);
 			caseexpr = 0;
-			o_local(val_addr);
-			o_deref(TYPE_BT(&t));
-			o_bop(O_EQ);
-			o_jz(l_failed);
-			o_tmpdrop(1);
+			if (o_popnum(&n))
+				err("const expr expected\n");
+			if (cases_n >= cases_sz) {
+				cases_sz = MAX(16, cases_sz * 2);
+				cases = mextend(cases, cases_n, cases_sz, sizeof(cases[0]));
+			}
+			cases[cases_n].val = n;
+			cases[cases_n].lab = LABEL();
+			o_label(cases[cases_n++].lab);
 		} else {
-			if (!ncases)
-				o_jmp(l_failed);
+			if (l_default)
+				err("duplicate default label\n");
 			l_default = LABEL();
 			o_label(l_default);
 		}
 		tok_req(":");
-		o_label(l_matched);
-		l_matched = LABEL();
-		ncases++;
 	}
 	o_rmlocal(val_addr, ULNG);
 	o_jmp(l_break);
-	o_label(l_failed);
-	if (l_default)
-		o_jmp(l_default);
+	o_label(l_dispatch);
+	qsort(cases + cases_beg, cases_n - cases_beg, sizeof(cases[0]),
+		swcase_cmp);
+	for (i = cases_beg + 1; i < cases_n; i++)
+		if (cases[i - 1].val == cases[i].val)
+			err("duplicate case value\n");
+	swdispatch(val_addr, TYPE_BT(&t), cases + cases_beg, cases_n - cases_beg,
+			l_default ? l_default : l_break);
+	cases_n = cases_beg;
 	o_label(l_break);
 	l_break = o_break;
 }
@@ -1463,7 +1601,7 @@ static void readstmt(void)
 		int _nstructs = structs_n;
 		int _nfuncs = funcs_n;
 		int _narrays = arrays_n;
-		while (tok_jmp("}"))
+		while (tok_until("}"))
 			readstmt();
 		locals_n = _nlocals;
 		enums_n = _nenums;
@@ -1471,7 +1609,7 @@ static void readstmt(void)
 		structs_n = _nstructs;
 		funcs_n = _nfuncs;
 		arrays_n = _narrays;
-		globals_n = _nglobals;
+		global_cut(_nglobals);
 		return;
 	}
 	if (!readdefs(localdef, 0)) {
@@ -1590,11 +1728,15 @@ static void readstmt(void)
 	}
 	if (!tok_jmp("break")) {
 		tok_req(";");
+		if (!l_break)
+			err("break outside loop or switch\n");
 		o_jmp(l_break);
 		return;
 	}
 	if (!tok_jmp("continue")) {
 		tok_req(";");
+		if (!l_cont)
+			err("continue outside loop\n");
 		o_jmp(l_cont);
 		return;
 	}
@@ -1638,17 +1780,83 @@ static void readdecl(void)
 		tok_req(";");
 		return;
 	}
-	readdefs_int(globaldef, 0);
+	if (readdefs_int(globaldef, 0) && !tok_comes(";"))
+		err("declaration expected\n");
 	tok_jmp(";");
 }
 
-static void parse(void)
+/* release the state of the parser */
+static void parse_done(void)
+{
+	free(locals);
+	free(globals);
+	htab_done(&globals_tab);
+	free(enums);
+	free(label_name);
+	free(label_ids);
+	free(cases);
+	free(funcs);
+	free(typedefs);
+	free(structs);
+	free(arrays);
+	locals = NULL;
+	globals = NULL;
+	enums = NULL;
+	label_name = NULL;
+	label_ids = NULL;
+	cases = NULL;
+	funcs = NULL;
+	typedefs = NULL;
+	structs = NULL;
+	arrays = NULL;
+	locals_n = locals_sz = 0;
+	globals_n = globals_sz = 0;
+	enums_n = enums_sz = 0;
+	label_n = label_sz = 0;
+	cases_n = cases_sz = 0;
+	funcs_n = funcs_sz = 0;
+	typedefs_n = typedefs_sz = 0;
+	structs_n = structs_sz = 0;
+	arrays_n = arrays_sz = 0;
+	nts = 0;
+	label = 0;
+	l_break = 0;
+	l_cont = 0;
+	ncexpr = 0;
+	caseexpr = 0;
+	tmp_id = 0;
+	tok_previden[0] = '\0';
+	func_name[0] = '\0';
+}
+
+/* parse the translation unit read by cpp */
+void ncc_parse(void)
 {
 	while (tok_jmp(""))
 		readdecl();
+	parse_done();
+	tok_done();
+}
+
+/*
+ * Release the state of all compilation stages, including those left
+ * by a compilation interrupted by die(), so that another translation
+ * unit may be compiled in the same process.
+ */
+void ncc_reset(void)
+{
+	parse_done();
+	tok_done();
+	cpp_done();
+	ic_done();
+	reg_done();
+	i_done();
+	o_done();
+	out_done();
 }
 
-static void compat_macros(void)
+/* define the predefined macros */
+void ncc_macros(void)
 {
 	cpp_define("__STDC__", "");
 	cpp_define("__linux__", "");
@@ -1675,81 +1883,11 @@ int opt(int level)
 	return level <= ncc_opt;
 }
 
-int main(int argc, char *argv[])
+/* set the optimization level */
+void opt_set(int level)
 {
-	char obj[128] = "";
-	int ofd = 1;
-	int cpp = 0;
-	int i;
-	compat_macros();
-	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
-		if (argv[i][1] == 'I')
-			cpp_path(argv[i][2] ? argv[i] + 2 : argv[++i]);
-		if (argv[i][1] == 'O')
-			ncc_opt = argv[i][2] ? atoi(argv[i] + 2) : 2;
-		if (argv[i][1] == 'E')
-			cpp = 1;
-		if (argv[i][1] == 'D') {
-			char *name = argv[i] + 2;
-			char *def = "";
-			char *eq = strchr(name, '=');
-			if (eq) {
-				*eq = '\0';
-				def = eq + 1;
-			}
-			cpp_define(name, def);
-		}
-		if (argv[i][1] == 'o')
-			strcpy(obj, argv[i][2] ? argv[i] + 2 : argv[++i]);
-		if (argv[i][1] == 'h') {
-			printf("Usage: %s [options] source\n", argv[0]);
-			printf("\n");
-			printf("Options:\n");
-			printf("  -I dir     \tspecify a header directory\n");
-			printf("  -o out     \tspecify output file name\n");
-			printf("  -E         \tpreprocess only\n");
-			printf("  -Dname=val \tdefine a macro\n");
-			printf("  -On        \toptimize (-O0 to disable)\n");
-			return 0;
-		}
-	}
-	if (i == argc)
-		die("neatcc: no file given\n");
-	if (cpp_init(argv[i]))
-		die("neatcc: cannot open <%s>\n", argv[i]);
-	if (cpp) {
-		long clen;
-		char *cbuf;
-		if (*obj)
-			ofd = open(obj, O_WRONLY | O_TRUNC | O_CREAT, 0600);
-		while (!cpp_read(&cbuf, &clen))
-			write(ofd, cbuf, clen);
-		if (*obj)
-			close(ofd);
-		return 0;
-	}
-	out_init(0);
-	parse();
-	if (!*obj) {
-		char *cp = strrchr(argv[i], '/');
-		strcpy(obj, cp ? cp + 1 : argv[i]);
-		obj[strlen(obj) - 1] = 'o';
-	}
-	free(locals);
-	free(globals);
-	free(label_name);
-	free(label_ids);
-	free(funcs);
-	free(typedefs);
-	free(structs);
-	free(arrays);
-	tok_done();
-	ofd = open(obj, O_WRONLY | O_TRUNC | O_CREAT, 0600);
-	o_write(ofd);
-	close(ofd);
-	return 0;
+	ncc_opt = level;
 }
-
 
 /* parsing function and variable declarations */
 
@@ -2056,7 +2194,7 @@ static void jumpbrace(void)
 {
 	int depth = 0;
 	while (!tok_comes("}") || depth--)
-		if (!strcmp("{", tok_get()))
+		if (!strcmp("{", tok_next()))
 			depth++;
 	tok_req("}");
 }
@@ -2075,7 +2213,7 @@ static int initsize(void)
 		return n;
 	}
 	tok_req("{");
-	while (tok_jmp("}")) {
+	while (tok_until("}")) {
 		long idx = n;
 		if (!tok_jmp("[")) {
 			readexpr();
@@ -2087,7 +2225,7 @@ static int initsize(void)
 		if (n < idx + 1)
 			n = idx + 1;
 		while (!tok_comes("}") && !tok_comes(","))
-			if (!strcmp("{", tok_get()))
+			if (!strcmp("{", tok_next()))
 				jumpbrace();
 		tok_jmp(",");
 	}
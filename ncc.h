@@ -17,9 +17,7 @@
 #define NTMPS		64		/* number of expression temporaries */
 #define NFIELDS		128		/* number of fields in structs */
 #define NAMELEN		128		/* size of identifiers */
-#define NDEFS		4096		/* number of macros */
 #define MARGLEN		1024		/* size of macro arguments */
-#define MDEFLEN		2048		/* size of macro definitions */
 #define NBUFS		32		/* macro expansion stack depth */
 #define NLOCS		1024		/* number of header search paths */
 
@@ -31,7 +29,9 @@
 void *mextend(void *old, long oldsz, long newsz, long memsz);
 void die(char *msg, ...);
 void err(char *fmt, ...);
+void die_catch(void *env, char *msg);
 int opt(int level);
+void opt_set(int level);
 
 /* variable length buffer */
 struct mem {
@@ -51,6 +51,24 @@ void mem_cpy(struct mem *mem, long off, void *buf, long len);
 long mem_len(struct mem *mem);
 void *mem_get(struct mem *mem);
 
+/* hash table of entries numbered in insertion order */
+struct htab {
+	int *head;		/* the newest entry of each bucket or -1 */
+	int *next;		/* the next older entry in the same bucket */
+	unsigned *hash;		/* the hash of each entry */
+	int n;			/* the number of entries */
+	int sz;			/* the size of next[] and hash[] */
+	int hsz;		/* the size of head[]; a power of two */
+};
+
+unsigned hash(char *s);
+int htab_put(struct htab *t, unsigned h);
+int htab_get(struct htab *t, unsigned h);
+int htab_next(struct htab *t, int i);
+void htab_pop(struct htab *t);
+void htab_clear(struct htab *t);
+void htab_done(struct htab *t);
+
 /* SECTION ONE: Tokenisation */
 void tok_init(char *path);
 void tok_done(void);
@@ -62,10 +80,54 @@ long tok_addr(void);
 void tok_jump(long addr);
 
 int cpp_init(char *path);
+void cpp_initbuf(char *path, char *src, long len);
+void cpp_done(void);
 void cpp_path(char *s);
 void cpp_define(char *name, char *def);
 char *cpp_loc(long addr);
 int cpp_read(char **buf, long *len);
+void cpp_report(int fd);
+void cpp_cache(char *path, int found);
+
+/* the parser and the driver */
+void ncc_macros(void);
+void ncc_parse(void);
+void ncc_reset(void);
+
+/* the object cache */
+void cache_set(char *dir, long max);
+int cache_key(char *path, char *key);
+int cache_get(char *key, char *out);
+int cache_hash(char *kind, void *buf, long len, char *key);
+int cache_load(char *key, struct mem *mem);
+void cache_put(char *key, char *buf, long len);
+
+/* the compile-time report */
+#define PR_CPP		0		/* preprocessing */
+#define PR_TOK		1		/* tokenizing */
+#define PR_PARSE	2		/* parsing */
+#define PR_IC		3		/* intermediate code */
+#define PR_FUNC		4		/* code generation */
+#define PR_OUT		5		/* writing the object */
+#define PR_REG		6		/* per function: register allocation */
+#define PR_GEN		7		/* per function: instruction selection */
+#define PR_CODE		8		/* per function: i_wrap() and i_code() */
+#define PR_CNT		9
+
+void prof_init(int on);
+int prof_enabled(void);
+long prof_now(void);
+void prof_beg(int phase);
+void prof_end(void);
+void prof_span(char *name);
+void prof_func(char *name, long tid, long *t);
+void prof_report(char *path);
+int prof_trace(char *path);
+
+/* the compile server */
+int ncc_main(int argc, char *argv[]);
+int srv_main(char *path);
+int srv_client(char *path, int argc, char **argv);
 
 /* SECTION TWO: Intermediate Code Generation */
 /* basic type meaning */
@@ -106,6 +168,7 @@ int cpp_read(char **buf, long *len);
 #define O_RET	0x008000	/*	-	R	-	-  */
 #define O_LD	0x010000	/*	R	RSL	D	-  */
 #define O_ST	0x020000	/*	-	R	RSL	D  */
+#define O_JTAB	0x040000	/*	-	R	D	C  */
 /* opcode flags: num, loc, sym */
 #define O_NUM	0x100000	/* instruction immediate */
 #define O_LOC	0x200000	/* local (frame pointer displacement) */
@@ -118,6 +181,7 @@ int cpp_read(char **buf, long *len);
 #define O_SHR		(1 | O_SHL)
 #define O_DIV		(1 | O_MUL)
 #define O_MOD		(2 | O_MUL)
+#define O_MULH		(3 | O_MUL)
 #define O_LT		(0 | O_CMP)
 #define O_GE		(1 | O_CMP)
 #define O_EQ		(2 | O_CMP)
@@ -156,6 +220,7 @@ int o_popsym(long *sym, long *off);
 void o_num(long n);
 void o_local(long addr);
 void o_sym(char *sym);
+void o_symoff(char *sym, long off);
 void o_tmpdrop(int n);
 void o_tmpswap(void);
 void o_tmpcopy(void);
@@ -167,6 +232,8 @@ long o_arg2loc(int i);
 void o_label(long id);
 void o_jmp(long id);
 void o_jz(long id);
+void o_jtab(long *ids, long n);
+long o_jtabnew(long n);
 long o_mark(void);
 void o_back(long mark);
 /* data/bss sections */
@@ -174,12 +241,18 @@ long o_dsnew(char *name, long size, int global);
 void o_dscpy(long addr, void *buf, long len);
 void o_dsset(char *name, long off, long bt);
 void o_bsnew(char *name, long size, int global);
+long o_rsnew(char *s);
 /* functions */
 void o_func_beg(char *name, int argc, int global, int vararg);
 void o_func_end(void);
 void o_code(char *name, char *c, long c_len);
 /* output */
-void o_write(int fd);
+void o_parallel(int n);
+void o_cachestat(long *hits, long *misses);
+void o_stream(int fd);
+int o_write(int fd, struct mem *obj);
+void *o_image(void);
+void o_done(void);
 
 /* SECTION THREE: The Intermediate Code */
 /* intermediate code instructions */
@@ -188,7 +261,7 @@ struct ic {
 	long a1;		/* first argument */
 	long a2;		/* second argument */
 	long a3;		/* more information, like jump target */
-	long *args;		/* call arguments */
+	long *args;		/* call arguments or jump table targets */
 };
 
 /* get the generated intermediate code */
@@ -197,6 +270,7 @@ int ic_num(struct ic *ic, long iv, long *num);
 int ic_sym(struct ic *ic, long iv, long *sym, long *off);
 long *ic_lastuse(struct ic *ic, long ic_n);
 void ic_free(struct ic *ic);
+void ic_done(void);
 int ic_regcnt(struct ic *ic);
 
 /* global register allocation */
@@ -244,7 +318,9 @@ void reg_done(void);
  * by calling os() and oi() functions and the current position in
  * the code segment is obtained by calling opos().  For branch
  * instructions, i_ins() returns the position of branch offset in
- * code segment, to be filled later with i_fill().
+ * code segment, to be filled later with i_fill().  For O_JTAB, the
+ * second operand is the symbol of the jump table, whose entries are
+ * filled by gen.c using i_labpos() once i_code() is called.
  *
  * Some macros should be defined in architecture-dependent headers
  * and a few variables should be defined for each architecture,
@@ -270,8 +346,10 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *mt);
 long i_ins(long op, long rd, long r1, long r2, long r3);
 int i_imm(long lim, long n);
 void i_label(long id);
+long i_labpos(long id);
 void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs_pos);
 void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *rcnt);
+void i_init(long flags);
 void i_done(void);
 
 extern int tmpregs[];
@@ -281,6 +359,7 @@ extern int argregs[];
 #define OUT_CS		0x0001		/* code segment symbol */
 #define OUT_DS		0x0002		/* data segment symbol */
 #define OUT_BSS		0x0004		/* bss segment symbol */
+#define OUT_RS		0x0008		/* the string section symbol */
 
 #define OUT_GLOB	0x0010		/* global symbol */
 
@@ -289,12 +368,22 @@ extern int argregs[];
 #define OUT_RL24	0x0400		/* 3-byte relocation */
 #define OUT_RL32	0x0800		/* 4-byte relocation */
 
+#define OUT_LOAD	0x1000		/* the object is loaded by out_load() */
+
 #define OUT_ALIGNMENT	16		/* section alignment */
+#define OUT_RSSYM	"__neatcc.s"	/* the symbol of the string section */
 
 void out_init(long flags);
 
 long out_sym(char *name);
+char *out_name(long id);
 void out_def(char *name, long flags, long off, long len);
 void out_rel(long id, long flags, long off);
 
-void out_write(int fd, char *cs, long cslen, char *ds, long dslen);
+int out_code(int fd, char *cs, long len);
+int out_write(int fd, struct mem *obj, char *cs, long cslen,
+		char *ds, long dslen, char *rs, long rslen);
+void out_done(void);
+void *out_load(char *cs, long cslen, char *ds, long dslen, char *rs, long rslen);
+void *out_addr(void *img, char *name);
+void out_unload(void *img);
@@ -1,9 +1,11 @@
 /* neatcc ELF object generation */
+#include <dlfcn.h>
 #include <elf.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "ncc.h"
 
 #define ALIGN(x, a)		(((x) + (a) - 1) & ~((a) - 1))
@@ -15,7 +17,21 @@
 #define SEC_DAT			5
 #define SEC_DATREL		6
 #define SEC_BSS			7
-#define NSECS			8
+#define SEC_STR			8
+#define NSECS			9
+
+#define STUBSZ			16	/* the size of out_load() stubs */
+
+/* whether out_load() can run the generated code in this process */
+#if defined(NEATCC_X64) && defined(__x86_64__)
+#  define LOADABLE	1
+#elif defined(NEATCC_X86) && defined(__i386__)
+#  define LOADABLE	1
+#elif defined(NEATCC_ARM) && defined(__arm__)
+#  define LOADABLE	1
+#else
+#  define LOADABLE	0
+#endif
 
 /* simplified elf struct and macro names */
 #if LONGSZ == 8
@@ -42,10 +58,14 @@
 #  define ELF_R_INFO	ELF32_R_INFO
 #endif
 
+#define CSOFF		(sizeof(Elf_Ehdr) + NSECS * sizeof(Elf_Shdr))
+
 static Elf_Ehdr ehdr;
 static Elf_Shdr shdr[NSECS];
+static long out_csn;		/* the length of the code written by out_code() */
 static Elf_Sym *syms;
 static long syms_n, syms_sz;
+static struct htab syms_tab;	/* syms[] hash table */
 static char *symstr;
 static long symstr_n, symstr_sz;
 
@@ -57,6 +77,9 @@ static long csrel_n, csrel_sz;
 void err(char *msg, ...);
 static int rel_type(int flags);
 static void ehdr_init(Elf_Ehdr *ehdr);
+static int rel_put(char *p, int type, char *s, char *stub);
+static void stub_put(char *p, char *addr);
+static long map_flags(void);
 
 static long symstr_add(char *name)
 {
@@ -70,10 +93,20 @@ static long symstr_add(char *name)
 	return symstr_n - len;
 }
 
-static long sym_find(char *name)
+/* rebuild the hash table of syms[] after reordering them */
+static void sym_rehash(void)
 {
-	int i;
+	long i;
+	htab_clear(&syms_tab);
 	for (i = 0; i < syms_n; i++)
+		htab_put(&syms_tab, hash(symstr + syms[i].st_name));
+}
+
+static long sym_find(char *name)
+{
+	long i;
+	for (i = htab_get(&syms_tab, hash(name)); i >= 0;
+			i = htab_next(&syms_tab, i))
 		if (!strcmp(name, symstr + syms[i].st_name))
 			return i;
 	return -1;
@@ -89,6 +122,7 @@ static Elf_Sym *put_sym(char *name)
 		syms_sz = MAX(128, syms_sz * 2);
 		syms = mextend(syms, syms_n, syms_sz, sizeof(syms[0]));
 	}
+	htab_put(&syms_tab, hash(name));
 	sym = &syms[syms_n++];
 	sym->st_name = symstr_add(name);
 	sym->st_shndx = SHN_UNDEF;
@@ -135,6 +169,7 @@ static int syms_sort(void)
 	glob_beg = j + 1;
 	mvrela(mv, csrel, csrel_n);
 	mvrela(mv, dsrel, dsrel_n);
+	sym_rehash();
 	free(mv);
 	return glob_beg;
 }
@@ -156,6 +191,11 @@ void out_def(char *name, long flags, long off, long len)
 		sym->st_shndx = SEC_DAT;
 	if (flags & OUT_BSS)
 		sym->st_shndx = SEC_BSS;
+	/* the linker finds merged strings only via section symbols */
+	if (flags & OUT_RS) {
+		sym->st_shndx = SEC_STR;
+		type = STT_SECTION;
+	}
 	sym->st_info = ELF_ST_INFO(bind, type);
 	sym->st_value = off;
 	sym->st_size = len;
@@ -166,6 +206,12 @@ long out_sym(char *name)
 	return put_sym(name) - syms;
 }
 
+/* the name of a symbol identifier */
+char *out_name(long idx)
+{
+	return symstr + syms[idx].st_name;
+}
+
 static void out_csrel(long idx, long off, int flags)
 {
 	Elf_Rel *r;
@@ -211,7 +257,47 @@ static long bss_len(void)
 	return len;
 }
 
-void out_write(int fd, char *cs, long cslen, char *ds, long dslen)
+/* write buf to fd at offset off or, if off is negative, at its position */
+static int out_putat(int fd, void *buf, long len, long off)
+{
+	char *s = buf;
+	if (off >= 0 && lseek(fd, off, SEEK_SET) < 0)
+		return 1;
+	while (len > 0) {
+		long n = write(fd, s, len);
+		if (n <= 0)
+			return 1;
+		s += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int out_put(int fd, struct mem *obj, void *buf, long len)
+{
+	if (obj) {
+		mem_put(obj, buf, len);
+		return 0;
+	}
+	return out_putat(fd, buf, len, -1);
+}
+
+/*
+ * Write the next len bytes of the code segment to the object file fd
+ * before out_write(), which then writes the rest of it and patches
+ * the headers.  Return nonzero on error.
+ */
+int out_code(int fd, char *cs, long len)
+{
+	if (out_putat(fd, cs, len, CSOFF + out_csn))
+		return 1;
+	out_csn += len;
+	return 0;
+}
+
+/* write the object; cs is the code not written by out_code() */
+int out_write(int fd, struct mem *obj, char *cs, long cslen,
+		char *ds, long dslen, char *rs, long rslen)
 {
 	Elf_Shdr *text_shdr = &shdr[SEC_TEXT];
 	Elf_Shdr *rela_shdr = &shdr[SEC_REL];
@@ -220,13 +306,16 @@ void out_write(int fd, char *cs, long cslen, char *ds, long dslen)
 	Elf_Shdr *dat_shdr = &shdr[SEC_DAT];
 	Elf_Shdr *datrel_shdr = &shdr[SEC_DATREL];
 	Elf_Shdr *bss_shdr = &shdr[SEC_BSS];
+	Elf_Shdr *str_shdr = &shdr[SEC_STR];
 	unsigned long offset = sizeof(ehdr);
+	int err = 0;
 
 	/* workaround for the idiotic gnuld; use neatld instead! */
 	text_shdr->sh_name = symstr_add(".cs");
 	rela_shdr->sh_name = symstr_add(USERELA ? ".rela.cs" : ".rels.cs");
 	dat_shdr->sh_name = symstr_add(".ds");
 	datrel_shdr->sh_name = symstr_add(USERELA ? ".rela.ds" : ".rels.ds");
+	str_shdr->sh_name = symstr_add(".rodata.str1.1");
 
 	ehdr.e_ident[0] = 0x7f;
 	ehdr.e_ident[1] = 'E';
@@ -248,7 +337,7 @@ void out_write(int fd, char *cs, long cslen, char *ds, long dslen)
 	text_shdr->sh_type = SHT_PROGBITS;
 	text_shdr->sh_flags = SHF_EXECINSTR | SHF_ALLOC;
 	text_shdr->sh_offset = offset;
-	text_shdr->sh_size = cslen;
+	text_shdr->sh_size = out_csn + cslen;
 	text_shdr->sh_entsize = 1;
 	text_shdr->sh_addralign = OUT_ALIGNMENT;
 	offset += text_shdr->sh_size;
@@ -292,25 +381,193 @@ void out_write(int fd, char *cs, long cslen, char *ds, long dslen)
 	bss_shdr->sh_entsize = 1;
 	bss_shdr->sh_addralign = OUT_ALIGNMENT;
 
+	str_shdr->sh_type = SHT_PROGBITS;
+	str_shdr->sh_flags = SHF_ALLOC | SHF_MERGE | SHF_STRINGS;
+	str_shdr->sh_offset = offset;
+	str_shdr->sh_size = rslen;
+	str_shdr->sh_entsize = 1;
+	str_shdr->sh_addralign = 1;
+	offset += str_shdr->sh_size;
+
 	symstr_shdr->sh_type = SHT_STRTAB;
 	symstr_shdr->sh_offset = offset;
 	symstr_shdr->sh_size = symstr_n;
 	symstr_shdr->sh_entsize = 1;
 	offset += symstr_shdr->sh_size;
 
-	write(fd, &ehdr, sizeof(ehdr));
-	write(fd, shdr,  NSECS * sizeof(shdr[0]));
-	write(fd, cs, cslen);
-	write(fd, csrel, csrel_n * sizeof(csrel[0]));
-	write(fd, syms, syms_n * sizeof(syms[0]));
-	write(fd, ds, dslen);
-	write(fd, dsrel, dsrel_n * sizeof(dsrel[0]));
-	write(fd, symstr, symstr_n);
+	/* the headers of streamed objects are written last */
+	if (out_csn) {
+		err = out_putat(fd, cs, cslen, CSOFF + out_csn);
+	} else {
+		err = err || out_put(fd, obj, &ehdr, sizeof(ehdr));
+		err = err || out_put(fd, obj, shdr,  NSECS * sizeof(shdr[0]));
+		err = err || out_put(fd, obj, cs, cslen);
+	}
+	err = err || out_put(fd, obj, csrel, csrel_n * sizeof(csrel[0]));
+	err = err || out_put(fd, obj, syms, syms_n * sizeof(syms[0]));
+	err = err || out_put(fd, obj, ds, dslen);
+	err = err || out_put(fd, obj, dsrel, dsrel_n * sizeof(dsrel[0]));
+	err = err || out_put(fd, obj, rs, rslen);
+	err = err || out_put(fd, obj, symstr, symstr_n);
+	if (out_csn) {
+		err = err || out_putat(fd, &ehdr, sizeof(ehdr), 0);
+		err = err || out_putat(fd, shdr, NSECS * sizeof(shdr[0]), sizeof(ehdr));
+	}
+	out_done();
+	return err;
+}
 
+/* release the symbols and relocations */
+void out_done(void)
+{
 	free(syms);
+	htab_done(&syms_tab);
 	free(symstr);
 	free(csrel);
 	free(dsrel);
+	syms = NULL;
+	symstr = NULL;
+	csrel = NULL;
+	dsrel = NULL;
+	syms_n = 0;
+	syms_sz = 0;
+	symstr_n = 0;
+	symstr_sz = 0;
+	csrel_n = 0;
+	csrel_sz = 0;
+	dsrel_n = 0;
+	dsrel_sz = 0;
+	out_csn = 0;
+	memset(&ehdr, 0, sizeof(ehdr));
+	memset(shdr, 0, sizeof(shdr));
+}
+
+/* an object loaded into this process by out_load() */
+struct out_img {
+	char *map;		/* the memory containing its sections */
+	long len;		/* the length of map */
+	char (*name)[NAMELEN];	/* global symbol names */
+	char **addr;		/* global symbol addresses */
+	long n;			/* number of global symbols */
+};
+
+static int out_relocs(char *sec, Elf_Rel *rels, long n, char **addr, char *stubs)
+{
+	long i;
+	for (i = 0; i < n; i++) {
+		long sym = ELF_R_SYM(rels[i].r_info);
+		char *stub = syms[sym].st_shndx == SHN_UNDEF ?
+			stubs + sym * STUBSZ : NULL;
+		if (rel_put(sec + rels[i].r_offset, ELF_R_TYPE(rels[i].r_info),
+				addr[sym], stub))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Load the object into the memory of this process, instead of writing
+ * it: map its sections, resolve undefined symbols with dlsym() and
+ * apply the relocations.  Calls to undefined symbols go through stubs
+ * after the code, since these symbols may be out of their reach.  The
+ * strings follow the stubs.
+ */
+void *out_load(char *cs, long cslen, char *ds, long dslen, char *rs, long rslen)
+{
+	struct out_img *img;
+	long pgsz = sysconf(_SC_PAGESIZE);
+	long stub_off = ALIGN(cslen, OUT_ALIGNMENT);
+	long rs_off = stub_off + syms_n * STUBSZ;
+	long ds_off = ALIGN(rs_off + rslen, pgsz);
+	long bss_off = ds_off + ALIGN(dslen, OUT_ALIGNMENT);
+	long len = ALIGN(bss_off + bss_len() + 1, pgsz);
+	char **addr;
+	char *map;
+	void *dl;
+	long i, n = 0;
+	if (!LOADABLE)
+		die("neatcc: cannot run code of this architecture\n");
+	addr = calloc(syms_n, sizeof(addr[0]));
+	dl = dlopen(NULL, RTLD_NOW);
+	for (i = 1; i < syms_n; i++) {
+		char *name = symstr + syms[i].st_name;
+		if (syms[i].st_shndx == SHN_UNDEF && !(addr[i] = dlsym(dl, name))) {
+			free(addr);
+			dlclose(dl);
+			die("neatcc: undefined symbol <%s>\n", name);
+		}
+	}
+	dlclose(dl);
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | map_flags(), -1, 0);
+	if (map == MAP_FAILED) {
+		free(addr);
+		die("neatcc: cannot map the code\n");
+	}
+	memcpy(map, cs, cslen);
+	memcpy(map + ds_off, ds, dslen);
+	memcpy(map + rs_off, rs, rslen);
+	for (i = 1; i < syms_n; i++) {
+		if (syms[i].st_shndx == SEC_TEXT)
+			addr[i] = map + syms[i].st_value;
+		if (syms[i].st_shndx == SEC_DAT)
+			addr[i] = map + ds_off + syms[i].st_value;
+		if (syms[i].st_shndx == SEC_BSS)
+			addr[i] = map + bss_off + syms[i].st_value;
+		if (syms[i].st_shndx == SEC_STR)
+			addr[i] = map + rs_off + syms[i].st_value;
+		if (syms[i].st_shndx == SHN_UNDEF)
+			stub_put(map + stub_off + i * STUBSZ, addr[i]);
+		if (ELF_ST_BIND(syms[i].st_info) == STB_GLOBAL &&
+				syms[i].st_shndx != SHN_UNDEF)
+			n++;
+	}
+	if (out_relocs(map, csrel, csrel_n, addr, map + stub_off) ||
+			out_relocs(map + ds_off, dsrel, dsrel_n, addr, map + stub_off)) {
+		munmap(map, len);
+		free(addr);
+		die("neatcc: relocation out of range\n");
+	}
+	mprotect(map, ds_off, PROT_READ | PROT_EXEC);
+#ifdef __GNUC__
+	__builtin___clear_cache(map, map + ds_off);
+#endif
+	img = malloc(sizeof(*img));
+	img->map = map;
+	img->len = len;
+	img->name = malloc(n * sizeof(img->name[0]) + 1);
+	img->addr = malloc(n * sizeof(img->addr[0]) + 1);
+	img->n = 0;
+	for (i = 1; i < syms_n; i++) {
+		if (ELF_ST_BIND(syms[i].st_info) == STB_GLOBAL &&
+				syms[i].st_shndx != SHN_UNDEF) {
+			strcpy(img->name[img->n], symstr + syms[i].st_name);
+			img->addr[img->n++] = addr[i];
+		}
+	}
+	free(addr);
+	out_done();
+	return img;
+}
+
+/* the address of a global symbol of an object loaded by out_load() */
+void *out_addr(void *img, char *name)
+{
+	struct out_img *o = img;
+	long i;
+	for (i = 0; i < o->n; i++)
+		if (!strcmp(name, o->name[i]))
+			return o->addr[i];
+	return NULL;
+}
+
+void out_unload(void *img)
+{
+	struct out_img *o = img;
+	munmap(o->map, o->len);
+	free(o->name);
+	free(o->addr);
+	free(o);
 }
 
 /* architecture dependent functions */
@@ -329,6 +586,34 @@ static int rel_type(int flags)
 	return flags & OUT_RLREL ? R_ARM_REL32 : R_ARM_ABS32;
 
 }
+
+static int rel_put(char *p, int type, char *s, char *stub)
+{
+	unsigned v;
+	long d;
+	memcpy(&v, p, 4);
+	if (type == R_ARM_PC24) {
+		d = ((int) (v << 8) >> 6) + (stub ? stub : s) - p;
+		v = (v & 0xff000000) | ((d >> 2) & 0x00ffffff);
+		memcpy(p, &v, 4);
+		return d < -(1 << 25) || d >= (1 << 25);
+	}
+	v += (long) s - (type == R_ARM_REL32 ? (long) p : 0);
+	memcpy(p, &v, 4);
+	return 0;
+}
+
+static void stub_put(char *p, char *addr)
+{
+	unsigned ldr = 0xe51ff004;	/* ldr pc, [pc, #-4] */
+	memcpy(p, &ldr, 4);
+	memcpy(p + 4, &addr, 4);
+}
+
+static long map_flags(void)
+{
+	return 0;
+}
 #endif
 
 #ifdef NEATCC_X64
@@ -345,6 +630,44 @@ static int rel_type(int flags)
 		return flags & OUT_RLSX ? R_X86_64_32S : R_X86_64_32;
 	return R_X86_64_64;
 }
+
+static int rel_put(char *p, int type, char *s, char *stub)
+{
+	long v;
+	int a;
+	if (type == R_X86_64_64) {
+		memcpy(&v, p, 8);
+		v += (long) s;
+		memcpy(p, &v, 8);
+		return 0;
+	}
+	memcpy(&a, p, 4);
+	if (type == R_X86_64_PC32)
+		v = a + ((stub ? stub : s) - p);
+	else
+		v = a + (long) s;
+	a = v;
+	memcpy(p, &a, 4);
+	if (type == R_X86_64_32)
+		return (unsigned long) v >> 32 != 0;
+	return a != v;
+}
+
+static void stub_put(char *p, char *addr)
+{
+	memcpy(p, "\xff\x25\x00\x00\x00\x00", 6);	/* jmp *0(%rip) */
+	memcpy(p + 6, &addr, 8);
+}
+
+/* jump tables are addressed with 32-bit displacements */
+static long map_flags(void)
+{
+#ifdef MAP_32BIT
+	return MAP_32BIT;
+#else
+	return 0;
+#endif
+}
 #endif
 
 #ifdef NEATCC_X86
@@ -357,4 +680,23 @@ static int rel_type(int flags)
 {
 	return flags & OUT_RLREL ? R_386_PC32 : R_386_32;
 }
+
+static int rel_put(char *p, int type, char *s, char *stub)
+{
+	int v;
+	memcpy(&v, p, 4);
+	v += (long) s - (type == R_386_PC32 ? (long) p : 0);
+	memcpy(p, &v, 4);
+	return 0;
+}
+
+/* PC-relative relocations reach the whole address space */
+static void stub_put(char *p, char *addr)
+{
+}
+
+static long map_flags(void)
+{
+	return 0;
+}
 #endif
@@ -0,0 +1,281 @@
+/* compile-time report */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "ncc.h"
+
+/*
+ * The time of each phase is measured exclusively: starting a phase
+ * with prof_beg() stops the clock of the enclosing one.  Phases of the
+ * code generator are measured per function by func_gen(), possibly in
+ * a worker process, and reported with prof_func().  The trace contains
+ * the top-level phases, the front-end of each function (with the time
+ * of its nested phases as arguments) and the code generation of each
+ * function, in the trace-event format.
+ */
+
+#define NSTK		32		/* maximum phase nesting */
+#define NSLOW		10		/* the number of reported functions */
+
+static char *pr_name[PR_CNT] = {
+	"preprocessing",
+	"tokenizing",
+	"parsing",
+	"intermediate code",
+	"code generation",
+	"object output",
+	"register allocation",
+	"instruction selection",
+	"prologue and assembly",
+};
+
+/* a traced event */
+struct pev {
+	char name[NAMELEN];	/* function or phase name */
+	char *cat;		/* event category */
+	long tid;		/* process id */
+	long beg, end;		/* start and end time */
+	long arg[PR_CNT];	/* the time of nested phases */
+	int narg;		/* whether arg[] is present */
+};
+
+static int pr_on;		/* reporting is enabled */
+static long pr_t0;		/* start time */
+static long pr_last;		/* the time the clock last switched phases */
+static long pr_tot[PR_CNT + 1];	/* the time spent in each phase */
+static int pr_stk[NSTK];	/* phase stack; pr_stk[0] is PR_CNT */
+static long pr_stkbeg[NSTK];	/* the start time of phases in pr_stk[] */
+static int pr_n;		/* the depth of pr_stk[] */
+static struct pev *pr_ev;	/* trace events */
+static long pr_evn, pr_evsz;
+static struct pev pr_span;	/* the front-end of the current function */
+static long pr_spantot[PR_CNT + 1];
+
+/* current time in nanoseconds */
+long prof_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* enable (if on is nonzero) and reset the report */
+void prof_init(int on)
+{
+	free(pr_ev);
+	pr_ev = NULL;
+	pr_evn = 0;
+	pr_evsz = 0;
+	memset(pr_tot, 0, sizeof(pr_tot));
+	pr_span.name[0] = '\0';
+	pr_on = on;
+	pr_n = 1;
+	pr_stk[0] = PR_CNT;
+	pr_t0 = on ? prof_now() : 0;
+	pr_last = pr_t0;
+	pr_stkbeg[0] = pr_t0;
+}
+
+/* whether reporting is enabled */
+int prof_enabled(void)
+{
+	return pr_on;
+}
+
+static struct pev *prof_ev(char *name, char *cat, long tid, long beg, long end)
+{
+	struct pev *ev;
+	if (pr_evn == pr_evsz) {
+		pr_evsz = MAX(128, pr_evsz * 2);
+		pr_ev = mextend(pr_ev, pr_evn, pr_evsz, sizeof(pr_ev[0]));
+	}
+	ev = &pr_ev[pr_evn++];
+	snprintf(ev->name, sizeof(ev->name), "%s", name);
+	ev->cat = cat;
+	ev->tid = tid;
+	ev->beg = beg;
+	ev->end = end;
+	ev->narg = 0;
+	return ev;
+}
+
+/* stop the clock of the current phase */
+static long prof_switch(void)
+{
+	long now = prof_now();
+	pr_tot[pr_stk[pr_n - 1]] += now - pr_last;
+	pr_last = now;
+	return now;
+}
+
+/* start phase */
+void prof_beg(int phase)
+{
+	if (!pr_on || pr_n == NSTK)
+		return;
+	pr_stkbeg[pr_n] = prof_switch();
+	pr_stk[pr_n++] = phase;
+}
+
+/* end the phase started by the last prof_beg() */
+void prof_end(void)
+{
+	long now;
+	if (!pr_on || pr_n <= 1)
+		return;
+	now = prof_switch();
+	pr_n--;
+	if (pr_n == 1)
+		prof_ev(pr_name[pr_stk[pr_n]], "phase", getpid(),
+			pr_stkbeg[pr_n], now);
+}
+
+/* start (if name is not NULL) or end the front-end of a function */
+void prof_span(char *name)
+{
+	long now;
+	int i;
+	if (!pr_on)
+		return;
+	now = prof_switch();
+	if (pr_span.name[0]) {
+		struct pev *ev = prof_ev(pr_span.name, "parse", getpid(),
+			pr_span.beg, now);
+		for (i = 0; i < PR_CNT; i++)
+			ev->arg[i] = pr_tot[i] - pr_spantot[i];
+		ev->narg = 1;
+		pr_span.name[0] = '\0';
+	}
+	if (name) {
+		snprintf(pr_span.name, sizeof(pr_span.name), "%s", name);
+		pr_span.beg = now;
+		memcpy(pr_spantot, pr_tot, sizeof(pr_tot));
+	}
+}
+
+/*
+ * Record the code generation of a function in process tid: t[0] and
+ * t[4] are its start and end times and t[1], t[2] and t[3] the start
+ * of register allocation, instruction selection and assembly.
+ */
+void prof_func(char *name, long tid, long *t)
+{
+	struct pev *ev;
+	int i;
+	if (!pr_on)
+		return;
+	ev = prof_ev(name, "codegen", tid, t[0], t[4]);
+	for (i = 0; i < PR_CNT; i++)
+		ev->arg[i] = 0;
+	for (i = PR_REG; i <= PR_CODE; i++) {
+		long beg = t[i - PR_REG + 1];
+		long end = t[i - PR_REG + 2];
+		ev->arg[i] = end - beg;
+		pr_tot[i] += end - beg;
+	}
+	ev->narg = 1;
+	for (i = PR_REG; i <= PR_CODE; i++)
+		if (ev->arg[i])
+			prof_ev(pr_name[i], "codegen", tid,
+				t[i - PR_REG + 1], t[i - PR_REG + 2]);
+}
+
+static int ev_cmp(const void *v1, const void *v2)
+{
+	struct pev *e1 = *(struct pev **) v1;
+	struct pev *e2 = *(struct pev **) v2;
+	long d1 = e1->end - e1->beg;
+	long d2 = e2->end - e2->beg;
+	return d1 < d2 ? 1 : (d1 > d2 ? -1 : 0);
+}
+
+#define MS(t)		((double) (t) / 1000000)
+
+/* print the report for the compilation of path to stderr */
+void prof_report(char *path)
+{
+	struct pev **slow;
+	long total, n = 0;
+	long i;
+	if (!pr_on)
+		return;
+	prof_switch();
+	total = pr_last - pr_t0;
+	fprintf(stderr, "%s: time report (ms)\n", path);
+	for (i = 0; i < PR_CNT; i++) {
+		if (i == PR_REG)
+			fprintf(stderr, "  per function:\n");
+		fprintf(stderr, "  %-24s %10.3f\n", pr_name[i], MS(pr_tot[i]));
+	}
+	fprintf(stderr, "  %-24s %10.3f\n", "other", MS(pr_tot[PR_CNT]));
+	fprintf(stderr, "  %-24s %10.3f\n", "total", MS(total));
+	slow = malloc((pr_evn + 1) * sizeof(slow[0]));
+	for (i = 0; i < pr_evn; i++)
+		if (pr_ev[i].narg && !strcmp(pr_ev[i].cat, "codegen"))
+			slow[n++] = &pr_ev[i];
+	qsort(slow, n, sizeof(slow[0]), ev_cmp);
+	if (n)
+		fprintf(stderr, "  %-24s %10s %10s %10s %10s\n", "slowest functions",
+			"regalloc", "isel", "asm", "total");
+	for (i = 0; i < n && i < NSLOW; i++)
+		fprintf(stderr, "  %-24s %10.3f %10.3f %10.3f %10.3f\n",
+			slow[i]->name, MS(slow[i]->arg[PR_REG]),
+			MS(slow[i]->arg[PR_GEN]), MS(slow[i]->arg[PR_CODE]),
+			MS(slow[i]->end - slow[i]->beg));
+	free(slow);
+}
+
+static void json_str(FILE *fp, char *s)
+{
+	fputc('"', fp);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', fp);
+		if ((unsigned char) *s < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char) *s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+/* write the trace of the compilation to path; return nonzero on error */
+int prof_trace(char *path)
+{
+	FILE *fp;
+	long i;
+	int j;
+	if (!pr_on)
+		return 0;
+	prof_switch();
+	if (!(fp = fopen(path, "w")))
+		return 1;
+	fprintf(fp, "{\"traceEvents\": [\n");
+	for (i = 0; i < pr_evn; i++) {
+		struct pev *ev = &pr_ev[i];
+		fprintf(fp, "{\"name\": ");
+		json_str(fp, ev->name);
+		fprintf(fp, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %ld, "
+			"\"tid\": %ld, \"ts\": %.3f, \"dur\": %.3f",
+			ev->cat, (long) getpid(), ev->tid,
+			(double) (ev->beg - pr_t0) / 1000,
+			(double) (ev->end - ev->beg) / 1000);
+		if (ev->narg) {
+			int first = 1;
+			fprintf(fp, ", \"args\": {");
+			for (j = 0; j < PR_CNT; j++) {
+				if (!ev->arg[j])
+					continue;
+				fprintf(fp, "%s\"%s (us)\": %.3f", first ? "" : ", ",
+					pr_name[j], (double) ev->arg[j] / 1000);
+				first = 0;
+			}
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "}%s\n", i + 1 < pr_evn ? "," : "");
+	}
+	fprintf(fp, "], \"displayTimeUnit\": \"ms\"}\n");
+	return fclose(fp) != 0;
+}
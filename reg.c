@@ -1,6 +1,7 @@
 /* neatcc global register allocation */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "ncc.h"
 
 #define IC_LLD(ic, i)		(O_C((ic)[i].op) == (O_LD | O_LOC) ? (ic)[i].a1 : -1)
@@ -31,171 +32,492 @@ struct rgn {
 	int reg;	/* register allocated to this region */
 };
 
-static struct rgn *rgn;		/* live regions */
+static struct rgn *rgn;		/* live regions, sorted by local and start */
 static int rgn_n;		/* number of entries in rgn[] */
 static int rgn_sz;		/* size of rgn[] */
+static long *loc_rgn;		/* the first region of each local in rgn[] */
+static int *reg_rgn;		/* allocated regions of each register by start */
+static int reg_rgnidx[N_REGS + 1];	/* the first entry of each register */
 
 static int *loc_ptr;		/* if the address of locals is accessed */
 static int loc_n;		/* number of locals */
 
-static long *dst_head;		/* lists of jumps to each instruction */
-static long *dst_next;		/* next entries in dst_head[] lists */
+/* registers clobbered by instruction i at ic_clob[ic_n + i] and a tree of their unions */
+static long *ic_clob;
+static long clob_n;
+
+#define NBITS		(8 * sizeof(unsigned long))
+
+static long *bb_beg;		/* the first instruction of each basic block */
+static long *bb_sidx;		/* the first successor of each block in bb_succ[] */
+static long *bb_succ;		/* block successors */
+static long bb_n;		/* number of basic blocks */
+
+/*
+ * A segment is a part of a basic block in which a local is live,
+ * bounded by the block boundaries, a store (which it includes) or the
+ * last load.  The segments of a local joined by control flow edges
+ * form its live regions.
+ */
+struct seg {
+	long loc;	/* local number */
+	long beg;	/* the first instruction */
+	long end;	/* the instruction after the last */
+	long cnt;	/* number of loads */
+	long par;	/* parent in the union-find forest */
+};
+
+/* a local live at a block boundary and its segment there */
+struct lvseg {
+	long loc;
+	long seg;
+};
+
+static struct seg *seg;
+static long seg_n, seg_sz;
 
 static void rgn_add(long loc, long beg, long end, long cnt)
 {
-	int i;
-	for (i = 0; i < rgn_n; i++) {
-		if (rgn[i].loc == loc && rgn[i].beg < end && rgn[i].end > beg) {
-			if (beg > rgn[i].beg)
-				beg = rgn[i].beg;
-			if (end < rgn[i].end)
-				end = rgn[i].end;
-			cnt += rgn[i].cnt;
-			rgn[i].loc = -1;
+	if (rgn_n >= rgn_sz) {
+		rgn_sz = MAX(16, rgn_sz * 2);
+		rgn = mextend(rgn, rgn_n, rgn_sz, sizeof(rgn[0]));
+	}
+	rgn[rgn_n].loc = loc;
+	rgn[rgn_n].beg = beg;
+	rgn[rgn_n].end = end;
+	rgn[rgn_n].cnt = cnt;
+	rgn[rgn_n].reg = -1;
+	rgn_n++;
+}
+
+/* split the function into basic blocks */
+static void bb_init(struct ic *ic, long ic_n, long *ic_bb)
+{
+	char *lead = calloc(ic_n + 1, 1);
+	long i, j, n;
+	lead[0] = 1;
+	for (i = 0; i < ic_n; i++) {
+		if (ic[i].op & (O_JXX | O_JTAB))
+			lead[i + 1] = 1;
+		if (ic[i].op & O_JXX)
+			lead[ic[i].a3] = 1;
+		for (j = 0; ic[i].op & O_JTAB && j < ic[i].a2; j++)
+			lead[ic[i].args[j]] = 1;
+	}
+	bb_n = 0;
+	for (i = 0; i < ic_n; i++)
+		bb_n += lead[i];
+	bb_beg = malloc((bb_n + 1) * sizeof(bb_beg[0]));
+	bb_sidx = malloc((bb_n + 1) * sizeof(bb_sidx[0]));
+	for (i = 0, n = 0; i < ic_n; i++) {
+		if (lead[i])
+			bb_beg[n++] = i;
+		ic_bb[i] = n - 1;
+	}
+	bb_beg[bb_n] = ic_n;
+	free(lead);
+	/* a block falls through unless it ends with a jump or a jump table */
+	for (n = 0, i = 0; i < bb_n; i++) {
+		struct ic *c = &ic[bb_beg[i + 1] - 1];
+		bb_sidx[i] = n;
+		n += bb_beg[i + 1] < ic_n && !(c->op & (O_JMP | O_JTAB));
+		n += (c->op & O_JXX) != 0;
+		n += c->op & O_JTAB ? c->a2 : 0;
+	}
+	bb_sidx[bb_n] = n;
+	bb_succ = malloc((n + 1) * sizeof(bb_succ[0]));
+	for (n = 0, i = 0; i < bb_n; i++) {
+		struct ic *c = &ic[bb_beg[i + 1] - 1];
+		if (bb_beg[i + 1] < ic_n && !(c->op & (O_JMP | O_JTAB)))
+			bb_succ[n++] = i + 1;
+		if (c->op & O_JXX)
+			bb_succ[n++] = ic_bb[c->a3];
+		for (j = 0; c->op & O_JTAB && j < c->a2; j++)
+			bb_succ[n++] = ic_bb[c->args[j]];
+	}
+}
+
+/* compute the locals live at the start and at the end of each block */
+static void bb_live(struct ic *ic, unsigned long *in, unsigned long *out, long nw)
+{
+	unsigned long *use = calloc(bb_n * nw, sizeof(use[0]));
+	unsigned long *def = calloc(bb_n * nw, sizeof(def[0]));
+	long b, i, j, loc;
+	int changed = 1;
+	for (b = 0; b < bb_n; b++) {
+		unsigned long *u = use + b * nw, *d = def + b * nw;
+		for (i = bb_beg[b]; i < bb_beg[b + 1]; i++) {
+			if ((loc = IC_LLD(ic, i)) >= 0 && !loc_ptr[loc] &&
+					!(d[loc / NBITS] & (1ul << (loc % NBITS))))
+				u[loc / NBITS] |= 1ul << (loc % NBITS);
+			if ((loc = IC_LST(ic, i)) >= 0 && !loc_ptr[loc])
+				d[loc / NBITS] |= 1ul << (loc % NBITS);
 		}
 	}
-	for (i = 0; i < rgn_n; i++)
-		if (rgn[i].loc < 0)
-			break;
-	if (i == rgn_n) {
-		if (rgn_n >= rgn_sz) {
-			rgn_sz = MAX(16, rgn_sz * 2);
-			rgn = mextend(rgn, rgn_n, rgn_sz, sizeof(rgn[0]));
+	while (changed) {
+		changed = 0;
+		for (b = bb_n - 1; b >= 0; b--) {
+			unsigned long *o = out + b * nw, *n = in + b * nw;
+			for (j = 0; j < nw; j++)
+				o[j] = 0;
+			for (i = bb_sidx[b]; i < bb_sidx[b + 1]; i++)
+				for (j = 0; j < nw; j++)
+					o[j] |= in[bb_succ[i] * nw + j];
+			for (j = 0; j < nw; j++) {
+				unsigned long v = use[b * nw + j] | (o[j] & ~def[b * nw + j]);
+				if (v != n[j]) {
+					n[j] = v;
+					changed = 1;
+				}
+			}
 		}
-		rgn_n++;
 	}
-	rgn[i].loc = loc;
-	rgn[i].beg = beg;
-	rgn[i].end = end;
-	rgn[i].cnt = cnt;
-	rgn[i].reg = -1;
+	free(use);
+	free(def);
 }
 
-/* return nonzero if register reg is free from beg till end */
-static int rgn_available(long beg, long end, int reg)
+/* append the locals in bitset set and their segments in open[] to lv */
+static long lv_put(struct lvseg *lv, long n, unsigned long *set, long nw, long *open)
 {
-	int i;
-	for (i = 0; i < rgn_n; i++)
-		if (rgn[i].reg == reg)
-			if (rgn[i].beg < end && rgn[i].end > beg)
-				return 0;
-	return 1;
+	long j;
+	int k;
+	for (j = 0; j < nw; j++)
+		for (k = 0; set[j] && k < NBITS; k++)
+			if (set[j] & (1ul << k)) {
+				lv[n].loc = j * NBITS + k;
+				lv[n].seg = open[j * NBITS + k];
+				n++;
+			}
+	return n;
 }
 
-static long reg_region(struct ic *ic, long ic_n, long loc, long pos,
-		long *beg, long *end, char *mark)
+static long seg_new(long loc, long beg, long end, long cnt)
 {
-	long cnt = 0;
-	long dst;
-	for (; pos >= 0; pos--) {
-		if (pos < *beg)
-			*beg = pos;
-		if (pos + 1 > *end)
-			*end = pos + 1;
-		if (mark[pos])
-			break;
-		mark[pos] = 1;
-		if (IC_LST(ic, pos) == loc)
-			break;
-		if (IC_LLD(ic, pos) == loc)
-			cnt++;
-		dst = dst_head[pos];
-		while (dst >= 0) {
-			cnt += reg_region(ic, ic_n, loc, dst, beg, end, mark);
-			dst = dst_next[dst];
+	if (seg_n == seg_sz) {
+		seg_sz = MAX(128, seg_sz * 2);
+		seg = mextend(seg, seg_n, seg_sz, sizeof(seg[0]));
+	}
+	seg[seg_n].loc = loc;
+	seg[seg_n].beg = beg;
+	seg[seg_n].end = end;
+	seg[seg_n].cnt = cnt;
+	seg[seg_n].par = seg_n;
+	return seg_n++;
+}
+
+static long seg_find(long i)
+{
+	while (seg[i].par != i) {
+		seg[i].par = seg[seg[i].par].par;
+		i = seg[i].par;
+	}
+	return i;
+}
+
+/* the segment of loc in lv[0..n), which is sorted by local */
+static long lv_seg(struct lvseg *lv, long n, long loc)
+{
+	long l = 0, h = n;
+	while (l < h) {
+		long m = (l + h) / 2;
+		if (lv[m].loc < loc)
+			l = m + 1;
+		else
+			h = m;
+	}
+	return l < n && lv[l].loc == loc ? lv[l].seg : -1;
+}
+
+static int seg_cmp(const void *v1, const void *v2)
+{
+	struct seg *s1 = &seg[*(long *) v1];
+	struct seg *s2 = &seg[*(long *) v2];
+	if (s1->loc != s2->loc)
+		return s1->loc < s2->loc ? -1 : 1;
+	return s1->beg < s2->beg ? -1 : s1->beg > s2->beg;
+}
+
+/*
+ * Compute the live regions of locals.  After finding the locals live
+ * at block boundaries with a bitset dataflow analysis, the segments of
+ * each block are found in one backward pass over its instructions and
+ * those of a local joined by control flow edges are merged.  Each
+ * region covers the instructions between the first and the last
+ * instruction of such a group; overlapping regions of a local are
+ * merged too.  Stores to dead locals form single-instruction regions.
+ */
+static void reg_regions(struct ic *ic, long ic_n)
+{
+	long nw = (loc_n + NBITS - 1) / NBITS;
+	long *ic_bb = malloc(ic_n * sizeof(ic_bb[0]));
+	unsigned long *in, *out, w;
+	long *open = malloc(loc_n * sizeof(open[0]));
+	struct lvseg *lv_in, *lv_out;	/* live locals at block boundaries */
+	long *in_idx, *out_idx;		/* the first entry of each block */
+	long in_n = 0, out_n = 0, lv_sz = 0;
+	long *srt;
+	long b, i, j, loc, n;
+	bb_init(ic, ic_n, ic_bb);
+	in = calloc(bb_n * nw + 1, sizeof(in[0]));
+	out = calloc(bb_n * nw + 1, sizeof(out[0]));
+	bb_live(ic, in, out, nw);
+	for (i = 0; i < bb_n * nw; i++)
+		for (w = in[i] | out[i]; w; w &= w - 1)
+			lv_sz++;
+	lv_in = malloc((lv_sz + 1) * sizeof(lv_in[0]));
+	lv_out = malloc((lv_sz + 1) * sizeof(lv_out[0]));
+	in_idx = malloc((bb_n + 1) * sizeof(in_idx[0]));
+	out_idx = malloc((bb_n + 1) * sizeof(out_idx[0]));
+	for (i = 0; i < loc_n; i++)
+		open[i] = -1;
+	for (b = 0; b < bb_n; b++) {
+		long beg = bb_beg[b], end = bb_beg[b + 1];
+		unsigned long *o = out + b * nw;
+		for (j = 0; j < nw; j++)
+			for (i = 0; o[j] && i < NBITS; i++)
+				if (o[j] & (1ul << i))
+					open[j * NBITS + i] = seg_new(j * NBITS + i, end - 1, end, 0);
+		out_idx[b] = out_n;
+		out_n = lv_put(lv_out, out_n, o, nw, open);
+		for (i = end - 1; i >= beg; i--) {
+			if ((loc = IC_LLD(ic, i)) >= 0 && !loc_ptr[loc]) {
+				if (open[loc] < 0)
+					open[loc] = seg_new(loc, i, i + 1, 0);
+				seg[open[loc]].cnt++;
+			}
+			if ((loc = IC_LST(ic, i)) >= 0 && !loc_ptr[loc]) {
+				if (open[loc] >= 0)
+					seg[open[loc]].beg = i;
+				else
+					seg_new(loc, i, i + 1, 1);
+				open[loc] = -1;
+			}
+		}
+		in_idx[b] = in_n;
+		for (j = 0; j < nw; j++)
+			for (i = 0; in[b * nw + j] && i < NBITS; i++)
+				if (in[b * nw + j] & (1ul << i))
+					seg[open[j * NBITS + i]].beg = beg;
+		in_n = lv_put(lv_in, in_n, in + b * nw, nw, open);
+		for (i = in_idx[b]; i < in_n; i++)
+			open[lv_in[i].loc] = -1;
+	}
+	in_idx[bb_n] = in_n;
+	out_idx[bb_n] = out_n;
+	/* joining the segments of a local across control flow edges */
+	for (b = 0; b < bb_n; b++) {
+		for (i = bb_sidx[b]; i < bb_sidx[b + 1]; i++) {
+			long s = bb_succ[i];
+			for (j = in_idx[s]; j < in_idx[s + 1]; j++) {
+				long s1 = seg_find(lv_in[j].seg);
+				long s2 = seg_find(lv_seg(lv_out + out_idx[b],
+					out_idx[b + 1] - out_idx[b], lv_in[j].loc));
+				if (s1 != s2)
+					seg[s1].par = s2;
+			}
 		}
-		if (pos > 0 && ic[pos - 1].op & O_JMP)
-			break;
 	}
-	return cnt;
+	/* the extent of each group */
+	for (i = 0; i < seg_n; i++) {
+		long r = seg_find(i);
+		if (r != i) {
+			seg[r].beg = MIN(seg[r].beg, seg[i].beg);
+			seg[r].end = MAX(seg[r].end, seg[i].end);
+			seg[r].cnt += seg[i].cnt;
+		}
+	}
+	srt = malloc((seg_n + 1) * sizeof(srt[0]));
+	for (i = 0, n = 0; i < seg_n; i++)
+		if (seg[i].par == i)
+			srt[n++] = i;
+	qsort(srt, n, sizeof(srt[0]), seg_cmp);
+	for (i = 0; i < n; i++) {
+		struct seg *s = &seg[srt[i]];
+		struct rgn *r = rgn_n ? &rgn[rgn_n - 1] : NULL;
+		if (r && r->loc == s->loc && s->beg < r->end) {
+			r->end = MAX(r->end, s->end);
+			r->cnt += s->cnt;
+		} else {
+			rgn_add(s->loc, s->beg, s->end, s->cnt);
+		}
+	}
+	free(srt);
+	free(seg);
+	seg = NULL;
+	seg_n = 0;
+	seg_sz = 0;
+	free(lv_in);
+	free(lv_out);
+	free(in_idx);
+	free(out_idx);
+	free(in);
+	free(out);
+	free(open);
+	free(ic_bb);
+	free(bb_beg);
+	free(bb_sidx);
+	free(bb_succ);
 }
 
-/* compute local's live regions */
-static void reg_regions(struct ic *ic, long ic_n, long loc)
+/* a mask of the specific registers an instruction requires */
+static long reg_fixed(long mask)
 {
-	char *mark;
-	long beg, end;
-	long cnt;
+	int cnt = 0;
+	int i;
+	for (i = 0; i < N_REGS; i++)
+		if ((1 << i) & mask & R_TMPS)
+			cnt++;
+	return cnt <= 3 ? mask & R_TMPS : 0;
+}
+
+/* compute the registers clobbered or required by each instruction */
+static void reg_clob(struct ic *ic, long ic_n)
+{
+	long md, m1, m2, m3, mt;
+	long *clob;
 	long i;
-	mark = calloc(ic_n, sizeof(mark[0]));
+	int j;
+	clob_n = ic_n;
+	ic_clob = calloc(2 * ic_n + 1, sizeof(ic_clob[0]));
+	clob = ic_clob + ic_n;
 	for (i = 0; i < ic_n; i++) {
-		if (IC_LLD(ic, i) == loc && !mark[i]) {
-			beg = i;
-			end = i + 1;
-			cnt = reg_region(ic, ic_n, loc, i, &beg, &end, mark);
-			rgn_add(loc, beg, end, cnt);
-		}
+		int n = ic_regcnt(ic + i);
+		if (i_reg(ic[i].op, &md, &m1, &m2, &m3, &mt))
+			continue;
+		clob[i] = mt;
+		if (ic[i].op & O_OUT)
+			clob[i] |= reg_fixed(md);
+		if (n >= 1)
+			clob[i] |= reg_fixed(m1);
+		if (n >= 2)
+			clob[i] |= reg_fixed(m2);
+		if (n >= 3)
+			clob[i] |= reg_fixed(m3);
+		if (ic[i].op & O_CALL)
+			for (j = 0; j < MIN(N_ARGS, ic[i].a3); j++)
+				clob[i] |= 1 << argregs[j];
 	}
-	for (i = 0; i < ic_n; i++)
-		if (IC_LST(ic, i) == loc && !mark[i])
-			rgn_add(loc, i, i + 1, 1);
-	free(mark);
+	for (i = ic_n - 1; i > 0; i--)
+		ic_clob[i] = ic_clob[2 * i] | ic_clob[2 * i + 1];
 }
 
-/* number of times a local is accessed */
-static long reg_loccnt(struct ic *ic, long ic_n, long loc)
+/* the registers clobbered by instructions beg to end - 1 */
+static long reg_clobbed(long beg, long end)
 {
-	long cnt = 0;
-	long i;
-	for (i = 0; i < ic_n; i++)
-		if (IC_LLD(ic, i) == loc || IC_LST(ic, i) == loc)
-			cnt++;
-	return cnt;
+	long mask = 0;
+	for (beg += clob_n, end += clob_n; beg < end; beg >>= 1, end >>= 1) {
+		if (beg & 1)
+			mask |= ic_clob[beg++];
+		if (end & 1)
+			mask |= ic_clob[--end];
+	}
+	return mask;
 }
 
-/* perform global register allocation */
+static int rgn_cmp(const void *v1, const void *v2)
+{
+	struct rgn *r1 = &rgn[*(int *) v1];
+	struct rgn *r2 = &rgn[*(int *) v2];
+	if (r1->beg != r2->beg)
+		return r1->beg < r2->beg ? -1 : 1;
+	return *(int *) v1 - *(int *) v2;
+}
+
+/*
+ * Perform global register allocation by a linear scan over live
+ * regions, sorted by their start.  Registers are taken from the end of
+ * tmpregs[], opposite to the registers gen.c prefers for values, and
+ * those clobbered inside a region (for instance caller-saved registers
+ * for regions containing a call) are avoided.  When no register is
+ * available, the active region with fewer accesses is evicted.
+ *
+ * Only locals are allocated here; IC values are still assigned
+ * registers per instruction by gen.c, which is why at most regs_max
+ * registers are held by locals at any point.
+ */
 static void reg_glob(int leaf)
 {
-	int *srt;
-	int regs[N_REGS];
-	int i, j;
-	int regs_max = MIN(N_TMPS >> 1, 4);
-	long regs_mask = leaf ? R_TMPS : R_PERM;
-	int regs_n = 0;
-	for (i = leaf ? 1 : 3; i < N_TMPS && regs_n < regs_max; i++)
-		if ((1 << i) & regs_mask)
-			regs[regs_n++] = i;
-	srt = malloc(rgn_n * sizeof(srt[0]));
-	/* sorting locals */
-	for (i = 0; i < rgn_n; i++) {
-		for (j = i - 1; j >= 0 && rgn[i].cnt > rgn[srt[j]].cnt; j--)
-			srt[j + 1] = srt[j];
-		srt[j + 1] = i;
-	}
-	/* allocating registers */
+	int *srt;			/* regions sorted by their start */
+	int *act;			/* active regions */
+	int act_n = 0;
+	int regs_max = MAX(N_TMPS >> 1, N_TMPS - 4);
+	int i, j, k;
+	srt = malloc((rgn_n + 1) * sizeof(srt[0]));
+	act = malloc((rgn_n + N_REGS) * sizeof(act[0]));
+	for (i = 0; i < rgn_n; i++)
+		srt[i] = i;
+	qsort(srt, rgn_n, sizeof(srt[0]), rgn_cmp);
 	for (i = 0; i < rgn_n; i++) {
-		int r = srt[i];
-		long loc = rgn[r].loc;
-		long beg = rgn[r].beg;
-		long end = rgn[r].end;
-		if (loc < 0 || loc_ptr[loc])
-			continue;
-		if (leaf && loc < N_ARGS && beg == 0 &&
-				rgn_available(beg, end, argregs[loc])) {
-			rgn[r].reg = argregs[loc];
+		struct rgn *r = &rgn[srt[i]];
+		long used = 0, mask;
+		int victim = -1;
+		if (loc_ptr[r->loc])
 			continue;
+		/* expiring regions ending before this one */
+		for (j = 0, k = 0; j < act_n; j++)
+			if (rgn[act[j]].end > r->beg)
+				act[k++] = act[j];
+		act_n = k;
+		for (j = 0; j < act_n; j++)
+			used |= 1 << rgn[act[j]].reg;
+		mask = reg_clobbed(r->beg, r->end);
+		/* arguments of leaf functions may stay in their registers */
+		if (N_ARGS && leaf && r->loc < N_ARGS && r->beg == 0 &&
+				!(used & (1 << argregs[r->loc]))) {
+			r->reg = argregs[r->loc];
+		} else if (act_n < regs_max) {
+			for (j = N_TMPS - 1; j >= 0; j--)
+				if (!((1 << tmpregs[j]) & (used | mask)))
+					break;
+			if (j >= 0)
+				r->reg = tmpregs[j];
+		}
+		/* evicting the least used active region */
+		if (r->reg < 0) {
+			for (j = 0; j < act_n; j++)
+				if (!((1 << rgn[act[j]].reg) & mask) &&
+						rgn[act[j]].cnt < r->cnt &&
+						(victim < 0 || rgn[act[j]].cnt <
+						rgn[act[victim]].cnt))
+					victim = j;
+			if (victim < 0)
+				continue;
+			r->reg = rgn[act[victim]].reg;
+			rgn[act[victim]].reg = -1;
+			act[victim] = act[--act_n];
 		}
-		for (j = 0; j < regs_n; j++)
-			if (rgn_available(beg, end, regs[j]))
-				break;
-		if (j < regs_n)
-			rgn[r].reg = regs[j];
+		act[act_n++] = r - rgn;
 	}
+	/* the regions allocated to each register, which do not overlap */
+	memset(reg_rgnidx, 0, sizeof(reg_rgnidx));
+	for (i = 0; i < rgn_n; i++)
+		if (rgn[i].reg >= 0)
+			reg_rgnidx[rgn[i].reg + 1]++;
+	for (i = 0; i < N_REGS; i++)
+		reg_rgnidx[i + 1] += reg_rgnidx[i];
+	reg_rgn = malloc((reg_rgnidx[N_REGS] + 1) * sizeof(reg_rgn[0]));
+	for (i = 0; i < N_REGS; i++)
+		act[i] = reg_rgnidx[i];
+	for (i = 0; i < rgn_n; i++)
+		if (rgn[srt[i]].reg >= 0)
+			reg_rgn[act[rgn[srt[i]].reg]++] = srt[i];
 	free(srt);
+	free(act);
 }
 
 void reg_init(struct ic *ic, long ic_n)
 {
 	long loc, off;
 	int *loc_sz;
+	long *cnt;
 	int leaf = 1;
 	long i;
 	for (i = 0; i < ic_n; i++)
 		if (ic[i].op & O_LOC && !ic_loc(ic, i, &loc, &off))
 			if (loc + 1 >= loc_n)
 				loc_n = loc + 1;
-	loc_ptr = calloc(loc_n, sizeof(loc_ptr[0]));
-	loc_sz = calloc(loc_n, sizeof(loc_sz[0]));
+	loc_ptr = calloc(loc_n + 1, sizeof(loc_ptr[0]));
+	loc_sz = calloc(loc_n + 1, sizeof(loc_sz[0]));
 	for (i = 0; i < loc_n; i++)
 		loc_ptr[i] = !opt(1);
 	for (i = 0; i < ic_n; i++) {
@@ -216,23 +538,27 @@ void reg_init(struct ic *ic, long ic_n)
 	for (i = 0; i < ic_n; i++)
 		if (ic[i].op & O_CALL)
 			leaf = 0;
-	dst_head = malloc(ic_n * sizeof(dst_head[0]));
-	dst_next = malloc(ic_n * sizeof(dst_next[0]));
-	for (i = 0; i < ic_n; i++)
-		dst_head[i] = -1;
-	for (i = 0; i < ic_n; i++)
-		dst_next[i] = -1;
-	for (i = 0; i < ic_n; i++) {
-		if (ic[i].op & O_JXX) {
-			dst_next[i] = dst_head[ic[i].a3];
-			dst_head[ic[i].a3] = i;
+	reg_clob(ic, ic_n);
+	if (opt(2)) {
+		reg_regions(ic, ic_n);
+	} else {
+		cnt = calloc(loc_n + 1, sizeof(cnt[0]));
+		for (i = 0; i < ic_n; i++) {
+			if ((loc = IC_LLD(ic, i)) >= 0)
+				cnt[loc]++;
+			if ((loc = IC_LST(ic, i)) >= 0)
+				cnt[loc]++;
 		}
+		for (i = 0; i < loc_n; i++)
+			if (!loc_ptr[i])
+				rgn_add(i, 0, ic_n, cnt[i]);
+		free(cnt);
 	}
-	for (i = 0; i < loc_n; i++) {
-		if (!loc_ptr[i] && opt(2))
-			reg_regions(ic, ic_n, i);
-		if (!loc_ptr[i] && !opt(2))
-			rgn_add(i, 0, ic_n, reg_loccnt(ic, ic_n, i));
+	loc_rgn = malloc((loc_n + 1) * sizeof(loc_rgn[0]));
+	for (i = 0, loc = 0; loc <= loc_n; loc++) {
+		while (i < rgn_n && rgn[i].loc < loc)
+			i++;
+		loc_rgn[loc] = i;
 	}
 	reg_glob(leaf);
 }
@@ -247,39 +573,60 @@ long reg_mask(void)
 	return ret;
 }
 
+#define RGN(idx, i)	((idx) ? (idx)[i] : (i))
+
+/* the region containing c among non-overlapping regions idx[beg..end) */
+static int rgn_find(int *idx, long beg, long end, long c)
+{
+	long l = beg, h = end;
+	while (l < h) {
+		long m = (l + h) / 2;
+		if (rgn[RGN(idx, m)].beg <= c)
+			l = m + 1;
+		else
+			h = m;
+	}
+	if (l == beg || rgn[RGN(idx, l - 1)].end <= c)
+		return -1;
+	return RGN(idx, l - 1);
+}
+
 /* return the allocated register of local loc */
 int reg_lmap(long c, long loc)
 {
 	int i;
-	for (i = 0; i < rgn_n; i++)
-		if (rgn[i].loc == loc)
-			if (rgn[i].beg <= c && rgn[i].end > c)
-				return rgn[i].reg;
-	return -1;
+	if (loc < 0 || loc >= loc_n || !loc_rgn)
+		return -1;
+	i = rgn_find(NULL, loc_rgn[loc], loc_rgn[loc + 1], c);
+	return i >= 0 ? rgn[i].reg : -1;
 }
 
 /* return the local to which register reg is allocated */
 int reg_rmap(long c, long reg)
 {
 	int i;
-	for (i = 0; i < rgn_n; i++)
-		if (rgn[i].reg == reg)
-			if (rgn[i].beg <= c && rgn[i].end > c)
-				return rgn[i].loc;
-	return -1;
+	if (reg < 0 || reg >= N_REGS || !reg_rgn)
+		return -1;
+	i = rgn_find(reg_rgn, reg_rgnidx[reg], reg_rgnidx[reg + 1], c);
+	return i >= 0 ? rgn[i].loc : -1;
 }
 
 void reg_done(void)
 {
-	free(dst_head);
-	free(dst_next);
+	free(ic_clob);
 	free(loc_ptr);
+	free(loc_rgn);
+	free(reg_rgn);
 	free(rgn);
+	ic_clob = NULL;
 	loc_ptr = NULL;
+	loc_rgn = NULL;
+	reg_rgn = NULL;
 	rgn = NULL;
 	rgn_sz = 0;
 	rgn_n = 0;
 	loc_n = 0;
+	clob_n = 0;
 }
 
 int reg_safe(long loc)
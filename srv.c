@@ -0,0 +1,275 @@
+/* neatcc compile server */
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "ncc.h"
+
+/*
+ * The server listens on a Unix socket.  Each request contains the
+ * standard input, output and error of the client (passed as
+ * SCM_RIGHTS ancillary data) and a list of NUL-terminated strings:
+ * the working directory, the arguments and the environment, each list
+ * ending with an empty string.  Every request is read and compiled in
+ * a child of the server, which starts with the state of the server:
+ * the predefined macros and the file cache of cpp.c.  The server replies
+ * with the exit status of the job once it finishes.
+ */
+
+#define NJOBS		128		/* maximum number of running jobs */
+
+extern char **environ;
+
+static struct job {
+	int pid;		/* process id */
+	int conn;		/* client connection */
+	int fd;			/* the files read by the job (cpp_report()) */
+	struct mem rep;		/* the output of fd */
+} jobs[NJOBS];
+static int jobs_n;
+
+static int srv_open(char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path))
+		return -1;
+	strcpy(addr->sun_path, path);
+	return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+/* send or receive the standard file descriptors with a message */
+static long srv_msg(int sock, int *fds, long *len, int send)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+	} ctl;
+	long n;
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctl, 0, sizeof(ctl));
+	iov.iov_base = len;
+	iov.iov_len = sizeof(*len);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+	if (send) {
+		ctl.hdr.cmsg_level = SOL_SOCKET;
+		ctl.hdr.cmsg_type = SCM_RIGHTS;
+		ctl.hdr.cmsg_len = CMSG_LEN(3 * sizeof(int));
+		memcpy(CMSG_DATA(&ctl.hdr), fds, 3 * sizeof(int));
+		return sendmsg(sock, &msg, 0);
+	}
+	if ((n = recvmsg(sock, &msg, 0)) != sizeof(*len))
+		return -1;
+	if (!CMSG_FIRSTHDR(&msg) || ctl.hdr.cmsg_type != SCM_RIGHTS ||
+			ctl.hdr.cmsg_len != CMSG_LEN(3 * sizeof(int)))
+		return -1;
+	memcpy(fds, CMSG_DATA(&ctl.hdr), 3 * sizeof(int));
+	return n;
+}
+
+static int xread(int fd, char *buf, long len)
+{
+	long nr = 0, n;
+	while (nr < len && (n = read(fd, buf + nr, len - nr)) > 0)
+		nr += n;
+	return nr < len;
+}
+
+static int xwrite(int fd, char *buf, long len)
+{
+	long nw = 0, n;
+	while (nw < len && (n = write(fd, buf + nw, len - nw)) > 0)
+		nw += n;
+	return nw < len;
+}
+
+/* split a list of strings ending with an empty string */
+static char **srv_list(char **s, char *end, int *cnt)
+{
+	char **list;
+	char *r = *s;
+	int n = 0;
+	while (r < end && *r) {
+		r += strlen(r) + 1;
+		n++;
+	}
+	list = malloc((n + 1) * sizeof(list[0]));
+	for (n = 0; *s < end && **s; n++) {
+		list[n] = *s;
+		*s += strlen(*s) + 1;
+	}
+	list[n] = NULL;
+	*s += 1;
+	if (cnt)
+		*cnt = n;
+	return list;
+}
+
+/* compile a request in a new process */
+static void srv_job(int lfd, int conn)
+{
+	struct job *job = &jobs[jobs_n];
+	int fds[3];
+	int pfd[2];
+	long len;
+	char *req, *s, *cwd;
+	char **argv, **envp;
+	int argc;
+	int i;
+	if (pipe(pfd)) {
+		close(conn);
+		return;
+	}
+	/* the request is read by the child, not to block the server */
+	if ((job->pid = fork()) == 0) {
+		close(lfd);
+		close(pfd[0]);
+		for (i = 0; i < jobs_n; i++) {
+			close(jobs[i].conn);
+			close(jobs[i].fd);
+		}
+		if (srv_msg(conn, fds, &len, 0) < 0 || len <= 0)
+			exit(1);
+		req = malloc(len + 1);
+		if (xread(conn, req, len))
+			exit(1);
+		req[len] = '\0';
+		for (i = 0; i < 3; i++) {
+			dup2(fds[i], i);
+			close(fds[i]);
+		}
+		close(conn);
+		s = req;
+		cwd = s;
+		s += strlen(s) + 1;
+		argv = srv_list(&s, req + len, &argc);
+		envp = srv_list(&s, req + len, NULL);
+		if (argc < 1 || chdir(cwd))
+			die("neatcc: bad request\n");
+		environ = envp;
+		cpp_report(pfd[1]);
+		exit(ncc_main(argc, argv));
+	}
+	close(pfd[1]);
+	if (job->pid < 0) {
+		close(pfd[0]);
+		close(conn);
+		return;
+	}
+	job->conn = conn;
+	job->fd = pfd[0];
+	mem_init(&job->rep);
+	jobs_n++;
+}
+
+/* a job has finished; reply to its client and update the file cache */
+static void srv_done(struct job *job)
+{
+	char *s, *e;
+	int status, ret;
+	close(job->fd);
+	if (waitpid(job->pid, &status, 0) < 0)
+		status = 1 << 8;
+	ret = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+	write(job->conn, &ret, sizeof(ret));
+	close(job->conn);
+	s = mem_buf(&job->rep);
+	while ((e = strchr(s, '\n'))) {
+		*e = '\0';
+		if (s[0] && s[1] == ' ')
+			cpp_cache(s + 2, s[0] == 'f');
+		s = e + 1;
+	}
+	mem_done(&job->rep);
+	*job = jobs[--jobs_n];
+}
+
+/* run the compile server on Unix socket path */
+int srv_main(char *path)
+{
+	struct sockaddr_un addr;
+	struct pollfd fds[NJOBS + 1];
+	char buf[1 << 12];
+	long n;
+	int lfd, i;
+	if ((lfd = srv_open(path, &addr)) < 0)
+		die("neatcc: cannot create socket <%s>\n", path);
+	unlink(path);
+	if (bind(lfd, (void *) &addr, sizeof(addr)) || listen(lfd, 64))
+		die("neatcc: cannot listen on <%s>\n", path);
+	signal(SIGPIPE, SIG_IGN);
+	while (1) {
+		for (i = 0; i < jobs_n; i++) {
+			fds[i].fd = jobs[i].fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		fds[jobs_n].fd = jobs_n < NJOBS ? lfd : -1;
+		fds[jobs_n].events = POLLIN;
+		fds[jobs_n].revents = 0;
+		if (poll(fds, jobs_n + 1, -1) < 0)
+			continue;
+		/* in reverse, as srv_done() moves the last job */
+		for (i = jobs_n - 1; i >= 0; i--) {
+			if (!fds[i].revents)
+				continue;
+			if ((n = read(jobs[i].fd, buf, sizeof(buf))) > 0)
+				mem_put(&jobs[i].rep, buf, n);
+			else
+				srv_done(&jobs[i]);
+		}
+		if (fds[jobs_n].fd >= 0 && fds[jobs_n].revents & POLLIN) {
+			int conn = accept(lfd, NULL, NULL);
+			if (conn >= 0)
+				srv_job(lfd, conn);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Send a compile request to the server listening on path and return
+ * its exit status or -1 if the server cannot be reached.
+ */
+int srv_client(char *path, int argc, char **argv)
+{
+	struct sockaddr_un addr;
+	struct mem req;
+	char cwd[1 << 10];
+	int fds[3] = {0, 1, 2};
+	long len;
+	int sock, ret, i;
+	if ((sock = srv_open(path, &addr)) < 0)
+		return -1;
+	if (connect(sock, (void *) &addr, sizeof(addr)) || !getcwd(cwd, sizeof(cwd))) {
+		close(sock);
+		return -1;
+	}
+	mem_init(&req);
+	mem_put(&req, cwd, strlen(cwd) + 1);
+	for (i = 0; i < argc; i++)
+		mem_put(&req, argv[i], strlen(argv[i]) + 1);
+	mem_putc(&req, '\0');
+	for (i = 0; environ[i]; i++)
+		mem_put(&req, environ[i], strlen(environ[i]) + 1);
+	mem_putc(&req, '\0');
+	len = mem_len(&req);
+	if (srv_msg(sock, fds, &len, 1) < 0 ||
+			xwrite(sock, mem_buf(&req), len) ||
+			xread(sock, (void *) &ret, sizeof(ret)))
+		ret = -1;
+	mem_done(&req);
+	close(sock);
+	return ret;
+}
@@ -114,12 +114,16 @@ static int skipws(void)
 {
 	long clen;
 	char *cbuf;
+	int ret = 0;
 	while (1) {
 		if (off == len) {
 			clen = 0;
-			while (!clen)
-				if (cpp_read(&cbuf, &clen))
-					return 1;
+			prof_beg(PR_CPP);
+			while (!clen && !ret)
+				ret = cpp_read(&cbuf, &clen);
+			prof_end();
+			if (ret)
+				return 1;
 			mem_put(&tok_mem, cbuf, clen);
 			buf = mem_buf(&tok_mem);
 			len = mem_len(&tok_mem);
@@ -215,20 +219,27 @@ static int tok_read(void)
 	return 1;
 }
 
+static int tok_timed(void)
+{
+	int ret;
+	prof_beg(PR_TOK);
+	ret = tok_read();
+	prof_end();
+	return ret;
+}
+
 char *tok_get(void)
 {
-	if (!tok_set)
-		if (tok_read())
-			return "";
+	if (!tok_set && tok_timed())
+		return "";
 	tok_set = 0;
 	return mem_buf(&tok);
 }
 
 char *tok_see(void)
 {
-	if (!tok_set)
-		if (tok_read())
-			return "";
+	if (!tok_set && tok_timed())
+		return "";
 	tok_set = 1;
 	return mem_buf(&tok);
 }
@@ -254,4 +265,9 @@ void tok_done(void)
 {
 	mem_done(&tok);
 	mem_done(&tok_mem);
+	buf = NULL;
+	off = 0;
+	off_pre = 0;
+	len = 0;
+	tok_set = 0;
 }
@@ -177,6 +177,11 @@ static void i_mul(int rd, int r1, int r2)
 	op_rr(I_MUL, 4, r2, LONGSZ);
 }
 
+static void i_mulh(int op, int r2)
+{
+	op_rr(I_MUL, O_T(op) & T_MSIGN ? 5 : 4, r2, LONGSZ);
+}
+
 static void i_div(int op, int rd, int r1, int r2)
 {
 	long bt = O_T(op);
@@ -379,6 +384,11 @@ void i_label(long id)
 	lab_add(id + 1);
 }
 
+long i_labpos(long id)
+{
+	return lab_loc[id + 1];
+}
+
 static void i_rel(long sym, long flg, long off)
 {
 	if (rel_n == rel_sz) {
@@ -545,12 +555,33 @@ void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *
 	jmp_n = 0;
 }
 
+void i_init(long flags)
+{
+}
+
 void i_done(void)
 {
 	free(jmp_off);
 	free(jmp_dst);
 	free(jmp_op);
 	free(lab_loc);
+	free(rel_sym);
+	free(rel_flg);
+	free(rel_off);
+	mem_done(&cs);
+	jmp_off = NULL;
+	jmp_dst = NULL;
+	jmp_op = NULL;
+	lab_loc = NULL;
+	rel_sym = NULL;
+	rel_flg = NULL;
+	rel_off = NULL;
+	rel_n = 0;
+	rel_sz = 0;
+	lab_sz = 0;
+	jmp_n = 0;
+	jmp_sz = 0;
+	jmp_ret = 0;
 }
 
 long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
@@ -588,7 +619,7 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	if (oc & O_MUL) {
 		if (oc & O_NUM)
 			return 1;
-		*rd = oc == O_MOD ? (1 << R_RDX) : (1 << R_RAX);
+		*rd = oc == O_MOD || oc == O_MULH ? (1 << R_RDX) : (1 << R_RAX);
 		*r1 = (1 << R_RAX);
 		*r2 = R_TMPS & ~*rd & ~*r1;
 		if (oc == O_DIV)
@@ -654,6 +685,10 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		*r2 = oc & O_NUM ? 8 : R_TMPS;
 		return 0;
 	}
+	if (oc == O_JTAB) {
+		*r1 = R_TMPS;
+		return 0;
+	}
 	if (oc == O_JMP)
 		return 0;
 	return 1;
@@ -692,6 +727,8 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_div(op, R_RAX, r1, r2);
 		if (oc == O_MOD)
 			i_div(op, R_RDX, r1, r2);
+		if (oc == O_MULH)
+			i_mulh(op, r2);
 		return 0;
 	}
 	if (oc & O_CMP) {
@@ -737,6 +774,13 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		os("\xfc\xf3\xa4", 3);		/* cld; rep movs */
 		return 0;
 	}
+	if (oc == O_JTAB) {
+		os("\xff\x24", 2);		/* jmp *$x(,r1,4) */
+		oi(0x85 | (r1 << 3), 1);
+		i_rel(r2, OUT_CS, opos());
+		oi(0, 4);
+		return 0;
+	}
 	if (oc == O_RET) {
 		jmp_ret = opos();
 		jmp_add(O_JMP, i_jmp(op, 4), 0);